@@ -0,0 +1,135 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <stddef.h>
+#include <sched.h>
+#include <new>
+#include <utility>
+#include "IQueue.h"
+
+namespace ConcurrentQueues
+{
+  // Fixed capacity, array backed multi-producer/multi-consumer queue.
+  // Each slot carries a sequence number that tells producers and
+  // consumers whose turn it is to use the slot, so the only shared
+  // writes are one CAS on enqueuePos or dequeuePos per operation.
+  // No memory is allocated after construction.
+  template<class T>
+  class BoundedQueue : public IQueue<T> {
+  private:
+    // Value is raw storage, constructed only while
+    // the slot holds an item
+    struct Slot {
+      size_t Sequence;
+      union { T Value; };
+      Slot() {}
+      ~Slot() {}
+    };
+
+    char padding0[64];
+    Slot* slots;
+    size_t mask;
+    char padding1[64];
+    size_t enqueuePos;
+    char padding2[64];
+    size_t dequeuePos;
+    char padding3[64];
+
+    static size_t roundUp(size_t capacity) {
+      size_t size = 2;
+      while(size < capacity) size <<= 1;
+      return size;
+    }
+
+  public:
+    // Capacity is rounded up to the next power of two
+    BoundedQueue(size_t capacity) : enqueuePos(0), dequeuePos(0) {
+      size_t size = roundUp(capacity);
+      this->slots = new Slot[size];
+      this->mask = size - 1;
+      for(size_t i=0;i<size;i++)
+        this->slots[i].Sequence = i;
+    }
+
+    ~BoundedQueue() {
+      for(size_t pos = this->dequeuePos; pos != this->enqueuePos; pos++)
+        this->slots[pos & this->mask].Value.~T();
+      delete[] this->slots;
+    }
+
+    size_t Capacity() const { return this->mask + 1; }
+
+    // Returns false without blocking if the queue is full.
+    // The value is only constructed once a slot is claimed,
+    // so args are left untouched on failure.
+    template<class... Args>
+    bool TryEmplace(Args&&... args) {
+      Slot* slot;
+      size_t pos = __atomic_load_n(&this->enqueuePos, __ATOMIC_RELAXED);
+      while(true){
+        slot = &this->slots[pos & this->mask];
+        size_t seq = __atomic_load_n(&slot->Sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)pos;
+        if(diff == 0){
+          if(__sync_bool_compare_and_swap(&this->enqueuePos, pos, pos+1)) break;
+          pos = __atomic_load_n(&this->enqueuePos, __ATOMIC_RELAXED);
+        }else if(diff < 0){
+          return false;
+        }else{
+          pos = __atomic_load_n(&this->enqueuePos, __ATOMIC_RELAXED);
+        }
+      }
+      new (&slot->Value) T(std::forward<Args>(args)...);
+      __atomic_store_n(&slot->Sequence, pos+1, __ATOMIC_RELEASE);
+      return true;
+    }
+
+    bool TryEnqueue(const T& value) {
+      return this->TryEmplace(value);
+    }
+
+    bool TryEnqueue(T&& value) {
+      return this->TryEmplace(std::move(value));
+    }
+
+    // Waits for a free slot if the queue is full
+    template<class... Args>
+    void Emplace(Args&&... args) {
+      while(!this->TryEmplace(std::forward<Args>(args)...))
+        sched_yield();
+    }
+
+    void Enqueue(const T& value) {
+      this->Emplace(value);
+    }
+
+    void Enqueue(T&& value) {
+      this->Emplace(std::move(value));
+    }
+
+    bool Dequeue(T* value) {
+      Slot* slot;
+      size_t pos = __atomic_load_n(&this->dequeuePos, __ATOMIC_RELAXED);
+      while(true){
+        slot = &this->slots[pos & this->mask];
+        size_t seq = __atomic_load_n(&slot->Sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)(pos+1);
+        if(diff == 0){
+          if(__sync_bool_compare_and_swap(&this->dequeuePos, pos, pos+1)) break;
+          pos = __atomic_load_n(&this->dequeuePos, __ATOMIC_RELAXED);
+        }else if(diff < 0){
+          return false;
+        }else{
+          pos = __atomic_load_n(&this->dequeuePos, __ATOMIC_RELAXED);
+        }
+      }
+      *value = std::move(slot->Value);
+      slot->Value.~T();
+      // Hand the slot to the producer one lap ahead
+      __atomic_store_n(&slot->Sequence, pos+this->mask+1, __ATOMIC_RELEASE);
+      return true;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef CPUTOPOLOGY_H
+#define CPUTOPOLOGY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace ConcurrentQueues
+{
+  // Parses a kernel CPU list such as "0-3,8,10-11"
+  inline bool ParseCpuList(const char* text, std::vector<int>* out) {
+    out->clear();
+    const char* p = text;
+    while(*p && *p != '\n'){
+      char* end;
+      long a = strtol(p, &end, 10);
+      if(end == p || a < 0) return false;
+      long b = a;
+      if(*end == '-'){
+        p = end + 1;
+        b = strtol(p, &end, 10);
+        if(end == p || b < a) return false;
+      }
+      for(long i=a;i<=b;i++)
+        out->push_back((int)i);
+      if(*end == ',') end++;
+      else if(*end && *end != '\n') return false;
+      p = end;
+    }
+    return !out->empty();
+  }
+
+  // Where the CPUs this process may run on sit, read from /sys.
+  // Order() lists them in the order threads should be placed:
+  //
+  //   compact  fill a socket before the next, one thread per core
+  //            before any SMT sibling
+  //   smt      SMT siblings of a core next to each other, then the
+  //            next core of the same socket
+  //   scatter  alternate sockets, one thread per core before any
+  //            SMT sibling
+  //
+  // Missing /sys entries are treated as one socket, one core per CPU
+  // and one NUMA node, so the orders are still usable.
+  class CpuTopology {
+  public:
+    struct Cpu {
+      int Id;
+      int Package; // Socket
+      int Core; // Unique across packages
+      int Node; // NUMA node
+      int Sibling; // Rank among the SMT threads of its core
+      int CoreRank; // Rank of its core within the package
+    };
+
+  private:
+    std::vector<Cpu> cpus;
+    int packages;
+    int cores;
+    int nodes;
+
+    static int readInt(const char* path, int fallback) {
+      FILE* f = fopen(path, "r");
+      if(!f) return fallback;
+      int value;
+      if(fscanf(f, "%d", &value) != 1) value = fallback;
+      fclose(f);
+      return value;
+    }
+
+    static bool readList(const char* path, std::vector<int>* out) {
+      FILE* f = fopen(path, "r");
+      if(!f) return false;
+      char line[4096];
+      bool ok = fgets(line, sizeof(line), f) && ParseCpuList(line, out);
+      fclose(f);
+      return ok;
+    }
+
+    static int countDistinct(std::vector<int> values) {
+      std::sort(values.begin(), values.end());
+      return (int)(std::unique(values.begin(), values.end()) - values.begin());
+    }
+
+    static bool bySmt(const Cpu& a, const Cpu& b) {
+      if(a.Package != b.Package) return a.Package < b.Package;
+      if(a.CoreRank != b.CoreRank) return a.CoreRank < b.CoreRank;
+      return a.Sibling < b.Sibling;
+    }
+
+    static bool byCompact(const Cpu& a, const Cpu& b) {
+      if(a.Package != b.Package) return a.Package < b.Package;
+      if(a.Sibling != b.Sibling) return a.Sibling < b.Sibling;
+      return a.CoreRank < b.CoreRank;
+    }
+
+    static bool byScatter(const Cpu& a, const Cpu& b) {
+      if(a.Sibling != b.Sibling) return a.Sibling < b.Sibling;
+      if(a.CoreRank != b.CoreRank) return a.CoreRank < b.CoreRank;
+      return a.Package < b.Package;
+    }
+
+  public:
+    CpuTopology() : packages(1), cores(0), nodes(1) {
+      cpu_set_t allowed;
+      CPU_ZERO(&allowed);
+      if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        CPU_SET(0, &allowed);
+      char path[128];
+      for(int id=0;id<CPU_SETSIZE;id++){
+        if(!CPU_ISSET(id, &allowed)) continue;
+        Cpu cpu;
+        cpu.Id = id;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", id);
+        cpu.Package = readInt(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", id);
+        cpu.Core = readInt(path, id);
+        // Core ids repeat across packages
+        cpu.Core = cpu.Package * 65536 + cpu.Core;
+        cpu.Node = 0;
+        cpu.Sibling = 0;
+        std::vector<int> siblings;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", id);
+        if(readList(path, &siblings))
+          cpu.Sibling = (int)(std::find(siblings.begin(), siblings.end(), id) - siblings.begin());
+        this->cpus.push_back(cpu);
+      }
+
+      std::vector<int> nodeCpus;
+      for(int node=0;node<1024;node++){
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if(!readList(path, &nodeCpus)) continue;
+        for(size_t i=0;i<this->cpus.size();i++)
+          if(std::find(nodeCpus.begin(), nodeCpus.end(), this->cpus[i].Id) != nodeCpus.end())
+            this->cpus[i].Node = node;
+      }
+
+      std::vector<int> packageIds, coreIds, nodeIds;
+      for(size_t i=0;i<this->cpus.size();i++){
+        packageIds.push_back(this->cpus[i].Package);
+        coreIds.push_back(this->cpus[i].Core);
+        nodeIds.push_back(this->cpus[i].Node);
+      }
+      this->packages = countDistinct(packageIds);
+      this->cores = countDistinct(coreIds);
+      this->nodes = countDistinct(nodeIds);
+
+      // Rank each core among the allowed cores of its package
+      for(size_t i=0;i<this->cpus.size();i++){
+        std::vector<int> lower;
+        for(size_t j=0;j<this->cpus.size();j++)
+          if(this->cpus[j].Package == this->cpus[i].Package && this->cpus[j].Core < this->cpus[i].Core)
+            lower.push_back(this->cpus[j].Core);
+        this->cpus[i].CoreRank = countDistinct(lower);
+      }
+    }
+
+    int CpuCount() const { return (int)this->cpus.size(); }
+    int PackageCount() const { return this->packages; }
+    int CoreCount() const { return this->cores; }
+    int NodeCount() const { return this->nodes; }
+    const std::vector<Cpu>& Cpus() const { return this->cpus; }
+
+    // Returns false for an unknown policy
+    bool Order(const std::string& policy, std::vector<int>* out) const {
+      std::vector<Cpu> sorted(this->cpus);
+      if(policy == "compact") std::stable_sort(sorted.begin(), sorted.end(), byCompact);
+      else if(policy == "smt") std::stable_sort(sorted.begin(), sorted.end(), bySmt);
+      else if(policy == "scatter") std::stable_sort(sorted.begin(), sorted.end(), byScatter);
+      else return false;
+      out->clear();
+      for(size_t i=0;i<sorted.size();i++)
+        out->push_back(sorted[i].Id);
+      return true;
+    }
+  };
+
+  // Sets the CPU a thread created with attr will start on
+  inline bool PinAttr(pthread_attr_t* attr, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_attr_setaffinity_np(attr, sizeof(set), &set) == 0;
+  }
+
+  // Moves a running thread to one CPU
+  inline bool PinThread(pthread_t thread, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+  }
+}
+
+#endif
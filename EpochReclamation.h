@@ -0,0 +1,364 @@
+#ifndef EPOCHRECLAMATION_H
+#define EPOCHRECLAMATION_H
+
+#include <sched.h>
+#include <atomic>
+#include <vector>
+#include "NodePool.h"
+#include "QueueStats.h"
+
+namespace ConcurrentQueues
+{
+
+// Epoch based reclamation (Fraser 2004), an alternative reclamation
+// policy for LocklessQueue.  See HazardPointers.h for the interface.
+//
+// A thread pins the current global epoch in Enter and unpins it in
+// Exit.  Enter/Exit nest, so a whole batch of operations can run
+// under one pin.  Nodes are labelled with the global epoch when they
+// are retired and recycled once the global epoch has moved two past
+// that label, at which point no pinned thread can still see them.
+// Accesses need no hazard pointers or re-validation, but a thread
+// that stalls while pinned holds back reclamation for everyone.
+//
+// Enter publishes the pin and then issues a seq_cst fence before
+// re-reading the global epoch; tryAdvance issues one before reading
+// the pins, so one of the two always sees the other.  Epoch stores
+// and unpins are release and tryAdvance reads them with acquire, so
+// whatever a thread did while pinned happens before the advance
+// that lets its nodes be recycled.
+template<class N>
+class EpochReclamation {
+public:
+  static const bool Validates = false;
+
+  struct EpochRec {
+    char padding0[64];
+    std::atomic<unsigned long> Epoch; // Global epoch seen when pinned
+    std::atomic<bool> Pinned;
+    char padding1[64];
+    EpochRec* Next; // Set before the record is published, then fixed
+    std::atomic<bool> Active;
+    EpochReclamation* Domain; // Owner of this record
+    int Nesting; // Enter calls without a matching Exit
+    int Retired; // Retires since the last attempt to advance
+    std::vector<N*> Limbo[3]; // Retired nodes, by epoch % 3
+    unsigned long LimboEpoch[3]; // Epoch each Limbo list belongs to
+    NodeCache<N> Cache; // Free nodes owned by this thread
+    std::atomic<unsigned long> Unreclaimed; // Nodes in Limbo, for readers on other threads
+    unsigned long Published; // Share of the domain's Unreclaimed count
+    std::atomic<unsigned long> Bytes; // Size of the record and its vectors
+#ifdef CONCURRENTQUEUES_STATS
+    char padding2[64];
+    QueueStats Stats; // Written only by the owning thread
+    char padding3[64];
+#endif
+    EpochRec(EpochReclamation* domain) : Epoch(0), Pinned(false), Next(0), Active(true),
+                                         Domain(domain), Nesting(0), Retired(0), LimboEpoch(), Cache(),
+                                         Unreclaimed(0), Published(0), Bytes(sizeof(EpochRec)) {}
+  };
+  typedef EpochRec Record;
+
+private:
+  char padding0[64];
+  std::atomic<unsigned long> GlobalEpoch;
+  char padding1[64];
+  std::atomic<EpochRec*> HeadRec; // First record in chain
+  NodePool<N> Pool; // Recycled nodes shared by all records
+  std::atomic<unsigned long> UnreclaimedLimit; // 0 for no limit
+  char padding2[64];
+  std::atomic<unsigned long> Unreclaimed; // Sum of the records' Published counts
+  std::atomic<unsigned long> EagerReclaims; // Advances forced by the limit
+  std::atomic<unsigned long> Throttles;
+  std::atomic<unsigned long> StuckEpoch; // Epoch a throttle pass got nowhere in, or ~0
+  char padding3[64];
+
+  // Retires between attempts to advance the global epoch
+  static const int AdvanceInterval = 64;
+
+  // See HazardPointers::ThrottleYields
+  static const int ThrottleYields = 64;
+
+  EpochRec* first() { return this->HeadRec.load(std::memory_order_acquire); }
+
+  // Pairs with the advance in tryAdvance, so everything the
+  // threads pinned before it did happens before a recycle
+  unsigned long currentEpoch() { return this->GlobalEpoch.load(std::memory_order_acquire); }
+
+  static unsigned long limboSize(EpochRec* rec) {
+    return rec->Limbo[0].size() + rec->Limbo[1].size() + rec->Limbo[2].size();
+  }
+
+  // Keeps rec's share of Unreclaimed and its byte count up to
+  // date.  Called when Limbo lists are recycled and every
+  // AdvanceInterval retires, so the shared count lags each
+  // record by less than AdvanceInterval nodes.
+  void publish(EpochRec* rec) {
+    unsigned long size = limboSize(rec);
+    rec->Unreclaimed.store(size, std::memory_order_relaxed);
+    rec->Bytes.store(sizeof(EpochRec) + (rec->Limbo[0].capacity() + rec->Limbo[1].capacity() +
+                                         rec->Limbo[2].capacity()) * sizeof(N*), std::memory_order_relaxed);
+    if(size == rec->Published) return;
+    this->Unreclaimed.fetch_add(size - rec->Published, std::memory_order_relaxed);
+    rec->Published = size;
+  }
+
+  bool overLimit(EpochRec* rec) {
+    unsigned long limit = this->UnreclaimedLimit.load(std::memory_order_relaxed);
+    if(!limit) return false;
+    return this->Unreclaimed.load(std::memory_order_relaxed) + limboSize(rec) - rec->Published > limit;
+  }
+
+  // Recycles owner's Limbo list i into rec's cache
+  void recycle(EpochRec* rec, EpochRec* owner, int i) {
+    std::vector<N*>& limbo = owner->Limbo[i];
+    QUEUE_STAT(rec, ScanFreed, limbo.size());
+    for(size_t j=0;j<limbo.size();j++)
+      this->Pool.Free(&rec->Cache, limbo[j]);
+    limbo.clear();
+  }
+
+  // Recycle every Limbo list at least two epochs old
+  void reclaim(EpochRec* rec, unsigned long epoch) {
+    QUEUE_STAT(rec, Scans, 1);
+    for(int i=0;i<3;i++)
+      if(!rec->Limbo[i].empty() && rec->LimboEpoch[i] + 2 <= epoch)
+        this->recycle(rec, rec, i);
+    this->publish(rec);
+  }
+
+  static bool claim(EpochRec* other) {
+    if(other->Active.load(std::memory_order_relaxed)) return false;
+    bool inactive = false;
+    return other->Active.compare_exchange_strong(inactive, true, std::memory_order_acquire,
+                                                 std::memory_order_relaxed);
+  }
+
+  // Takes over the Limbo lists of released records, like
+  // HazardPointers::helpscan.  Lists old enough are recycled into
+  // rec's cache, the others are merged into rec's list for the
+  // same epoch.  Two labels that share a slot are three epochs
+  // apart, so whichever is older can already be recycled.
+  void adopt(EpochRec* rec, unsigned long epoch) {
+    QUEUE_STAT(rec, HelpScans, 1);
+    for(EpochRec* other = this->first(); other; other = other->Next){
+      if(other == rec || !other->Unreclaimed.load(std::memory_order_relaxed) || !claim(other)) continue;
+      for(int i=0;i<3;i++){
+        std::vector<N*>& limbo = other->Limbo[i];
+        if(limbo.empty()) continue;
+        if(other->LimboEpoch[i] + 2 <= epoch){
+          this->recycle(rec, other, i);
+          continue;
+        }
+        if(rec->LimboEpoch[i] != other->LimboEpoch[i]){
+          if(!rec->Limbo[i].empty()) this->recycle(rec, rec, i);
+          rec->LimboEpoch[i] = other->LimboEpoch[i];
+        }
+        rec->Limbo[i].insert(rec->Limbo[i].end(), limbo.begin(), limbo.end());
+        limbo.clear();
+      }
+      this->publish(other);
+      other->Active.store(false, std::memory_order_release);
+    }
+  }
+
+  // Advances if it can, then recycles what rec and
+  // the released records hold that is old enough
+  void reclaimAll(EpochRec* rec) {
+    this->tryAdvance();
+    unsigned long epoch = this->currentEpoch();
+    this->adopt(rec, epoch);
+    this->reclaim(rec, epoch);
+  }
+
+  // The global epoch can move on once every pinned
+  // thread has seen the current one
+  void tryAdvance() {
+    unsigned long epoch = this->GlobalEpoch.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for(EpochRec* rec = this->first(); rec; rec = rec->Next){
+      if(rec->Active.load(std::memory_order_relaxed) && rec->Pinned.load(std::memory_order_acquire) &&
+         rec->Epoch.load(std::memory_order_acquire) != epoch)
+        return;
+    }
+    this->GlobalEpoch.compare_exchange_strong(epoch, epoch+1, std::memory_order_acq_rel,
+                                              std::memory_order_relaxed);
+  }
+
+public:
+  EpochReclamation(int prewarm = 0) : GlobalEpoch(0), HeadRec(0), Pool(prewarm), UnreclaimedLimit(0),
+                                      Unreclaimed(0), EagerReclaims(0), Throttles(0),
+                                      StuckEpoch(~0UL) {}
+
+  ~EpochReclamation() {
+    EpochRec* rec = this->HeadRec.load(std::memory_order_relaxed);
+    while(rec){
+      EpochRec* next = rec->Next;
+      for(int i=0;i<3;i++)
+        for(size_t j=0;j<rec->Limbo[i].size();j++)
+          delete rec->Limbo[i][j];
+      this->Pool.Drain(&rec->Cache);
+      delete rec;
+      rec = next;
+    }
+  }
+
+  EpochRec* Acquire() {
+    // First try to reuse an old one that is not active anymore
+    for(EpochRec* rec = this->first(); rec; rec = rec->Next){
+      if(rec->Active.load(std::memory_order_relaxed)) continue;
+      bool inactive = false;
+      if(!rec->Active.compare_exchange_strong(inactive, true, std::memory_order_acquire,
+                                              std::memory_order_relaxed)) continue;
+      QUEUE_STAT(rec, RecordReuses, 1);
+      return rec;
+    }
+
+    EpochRec* rec = new EpochRec(this);
+    EpochRec* oldhead = this->HeadRec.load(std::memory_order_relaxed);
+    do {
+      rec->Next = oldhead;
+    }while(!this->HeadRec.compare_exchange_weak(oldhead, rec, std::memory_order_release,
+                                                std::memory_order_relaxed));
+    return rec;
+  }
+
+  // Nodes still in Limbo stay with the record until its next
+  // owner or another thread's reclaim pass adopts them
+  void Release(EpochRec* rec) {
+    rec->Nesting = 0;
+    rec->Pinned.store(false, std::memory_order_release);
+    this->Pool.Release(&rec->Cache);
+    rec->Active.store(false, std::memory_order_release);
+  }
+
+  void Enter(EpochRec* rec) {
+    if(rec->Nesting++ > 0) return;
+    // The pin has to be visible before any shared node is read,
+    // and must not name an epoch the others have already left.
+    unsigned long epoch;
+    do {
+      epoch = this->GlobalEpoch.load(std::memory_order_acquire);
+      rec->Epoch.store(epoch, std::memory_order_release);
+      rec->Pinned.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }while(this->GlobalEpoch.load(std::memory_order_relaxed) != epoch);
+    this->reclaim(rec, epoch);
+  }
+
+  void Exit(EpochRec* rec) {
+    if(--rec->Nesting > 0) return;
+    rec->Pinned.store(false, std::memory_order_release);
+  }
+
+  // Being pinned is all the protection needed
+  void Protect(EpochRec*, int, N*) {}
+
+  void Retire(EpochRec* rec, N* node) {
+    // The node is already unlinked, so a thread that pins the
+    // epoch read here or a later one can't reach it.  The unlink
+    // was seq_cst, so this load can't see an epoch older than it.
+    unsigned long epoch = this->GlobalEpoch.load(std::memory_order_seq_cst);
+    int i = epoch % 3;
+    if(rec->LimboEpoch[i] != epoch){
+      // Anything left here is from at least three epochs ago
+      this->recycle(rec, rec, i);
+      rec->LimboEpoch[i] = epoch;
+    }
+    rec->Limbo[i].push_back(node);
+    rec->Unreclaimed.store(limboSize(rec), std::memory_order_relaxed);
+    QUEUE_STAT_MAX(rec, RetireHighWater, limboSize(rec));
+    if(++rec->Retired >= AdvanceInterval){
+      rec->Retired = 0;
+      this->reclaimAll(rec);
+    }else if(this->overLimit(rec)){
+      // Over the limit, try to advance now rather than waiting
+      this->EagerReclaims.fetch_add(1, std::memory_order_relaxed);
+      this->reclaimAll(rec);
+    }
+  }
+
+  // Backpressure for producers.  A thread pinned in an old epoch
+  // holds back every Limbo list, so nothing but waiting for it
+  // helps; this yields to it ThrottleYields times at most.  Not
+  // inside a batch, where the caller's own pin may be the cause.
+  // A pass that ends without the epoch moving means a pin is
+  // stuck, and producers aren't held back again until it moves.
+  void Throttle(EpochRec* rec) {
+    if(rec->Nesting > 0 || !this->overLimit(rec)) return;
+    unsigned long epoch = this->currentEpoch();
+    if(epoch == this->StuckEpoch.load(std::memory_order_relaxed)) return;
+    this->Throttles.fetch_add(1, std::memory_order_relaxed);
+    for(int i=0;i<ThrottleYields && this->overLimit(rec);i++){
+      this->EagerReclaims.fetch_add(1, std::memory_order_relaxed);
+      this->reclaimAll(rec);
+      sched_yield();
+    }
+    if(this->overLimit(rec) && this->currentEpoch() == epoch)
+      this->StuckEpoch.store(epoch, std::memory_order_relaxed);
+  }
+
+  // A soft target for the retired nodes awaiting reclamation
+  // across all records, 0 to remove it.  Past it, Retire tries to
+  // advance eagerly and Throttle holds producers back, but nothing
+  // can be recycled while a thread stays pinned, so under a stalled
+  // pin the retired nodes keep growing past the limit.
+  void SetUnreclaimedLimit(unsigned long nodes) {
+    this->UnreclaimedLimit.store(nodes, std::memory_order_relaxed);
+  }
+
+  N* Alloc(EpochRec* rec) {
+    return this->Pool.Alloc(&rec->Cache);
+  }
+
+  void GetPoolStats(unsigned long* hits, unsigned long* misses) {
+    *hits = 0;
+    *misses = 0;
+    for(EpochRec* rec = this->first(); rec; rec = rec->Next){
+      *hits += rec->Cache.Hits.load(std::memory_order_relaxed);
+      *misses += rec->Cache.Misses.load(std::memory_order_relaxed);
+    }
+  }
+
+  // See HazardPointers::GetMemoryStats
+  void GetMemoryStats(MemoryStats* out) {
+    *out = MemoryStats();
+    unsigned long allocs = 0, frees = 0;
+    for(EpochRec* rec = this->first(); rec; rec = rec->Next){
+      out->Records++;
+      out->RecordBytes += rec->Bytes.load(std::memory_order_relaxed);
+      out->RetiredNodes += rec->Unreclaimed.load(std::memory_order_relaxed);
+      unsigned long misses = rec->Cache.Misses.load(std::memory_order_relaxed);
+      allocs += rec->Cache.Hits.load(std::memory_order_relaxed) + misses;
+      frees += rec->Cache.Frees.load(std::memory_order_relaxed);
+      out->AllocatedNodes += misses;
+    }
+    out->AllocatedNodes += this->Pool.Prewarmed();
+    out->LiveNodes = allocs - frees - out->RetiredNodes;
+    out->NodeBytes = out->AllocatedNodes * sizeof(N);
+    out->UnreclaimedLimit = this->UnreclaimedLimit.load(std::memory_order_relaxed);
+    out->EagerReclaims = this->EagerReclaims.load(std::memory_order_relaxed);
+    out->Throttles = this->Throttles.load(std::memory_order_relaxed);
+  }
+
+  // Scans count reclaim passes and HelpScans the passes over
+  // released records; there are no hazard pointers
+  bool GetStats(QueueStatsSnapshot* out) {
+    *out = QueueStatsSnapshot();
+    for(EpochRec* rec = this->first(); rec; rec = rec->Next){
+#ifdef CONCURRENTQUEUES_STATS
+      out->Totals.Add(rec->Stats);
+#endif
+      out->Records++;
+    }
+#ifdef CONCURRENTQUEUES_STATS
+    return true;
+#else
+    return false;
+#endif
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef EVENTCOUNT_H
+#define EVENTCOUNT_H
+
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include "Futex.h"
+
+namespace ConcurrentQueues
+{
+  // Lets consumers sleep until a producer has added something,
+  // without putting a lock or syscall on the producer's path.
+  // A consumer calls PrepareWait, re-checks the queue, then
+  // either CancelWait or Wait.  A producer calls Notify after
+  // adding; it only enters the kernel if someone is waiting.
+  class EventCount {
+  private:
+    char padding0[64];
+    int seq; // Bumped by every Notify that found waiters
+    int waiters; // Threads between PrepareWait and the end of Wait
+    char padding1[64];
+
+  public:
+    EventCount() : seq(0), waiters(0) {}
+
+    // Returns the key to pass to Wait
+    int PrepareWait() {
+      __sync_fetch_and_add(&this->waiters, 1);
+      return __atomic_load_n(&this->seq, __ATOMIC_ACQUIRE);
+    }
+
+    void CancelWait() {
+      __sync_fetch_and_sub(&this->waiters, 1);
+    }
+
+    // Sleeps unless a Notify happened since PrepareWait returned
+    // key.  Returns false if the timeout (0 for none) ran out.
+    bool Wait(int key, const timespec* timeout) {
+      int r = FutexWait(&this->seq, key, timeout);
+      bool timedout = r == -1 && errno == ETIMEDOUT;
+      __sync_fetch_and_sub(&this->waiters, 1);
+      return !timedout;
+    }
+
+    // For callers whose last write was a __sync operation or a
+    // seq_cst std::atomic one.  Reading waiters seq_cst as well
+    // keeps that write ordered before the read.
+    void NotifyAfterBarrier(int count = 1) {
+      if(!__atomic_load_n(&this->waiters, __ATOMIC_SEQ_CST)) return;
+      __sync_fetch_and_add(&this->seq, 1);
+      FutexWake(&this->seq, count);
+    }
+
+    // Wakes up to count waiters
+    void Notify(int count = 1) {
+      __sync_synchronize();
+      this->NotifyAfterBarrier(count);
+    }
+
+    void NotifyAll() {
+      this->Notify(INT_MAX);
+    }
+  };
+
+  // Dequeue that waits up to timeoutMicros (forever if negative)
+  // for a value.  Spins first, for as long as spinning has
+  // recently paid off, then sleeps on the EventCount.
+  template<class Q, class V>
+  bool BlockingDequeue(Q* queue, EventCount* events, int* spinLimit, V* value, long timeoutMicros) {
+    static const int MaxSpin = 4096;
+    // Shared by every consumer of the queue, it is only a hint
+    int limit = __atomic_load_n(spinLimit, __ATOMIC_RELAXED);
+    for(int i=0;i<limit;i++){
+      if(queue->Dequeue(value)){
+        // Spinning worked, allow a bit more next time
+        if(limit < MaxSpin) __atomic_store_n(spinLimit, limit + limit/8 + 1, __ATOMIC_RELAXED);
+        return true;
+      }
+      CpuRelax();
+    }
+    // Spinning didn't work, spin less next time
+    __atomic_store_n(spinLimit, limit - limit/8, __ATOMIC_RELAXED);
+
+    timespec deadline;
+    if(timeoutMicros >= 0){
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      deadline.tv_sec += timeoutMicros / 1000000;
+      deadline.tv_nsec += (timeoutMicros % 1000000) * 1000;
+      if(deadline.tv_nsec >= 1000000000){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+    }
+    while(true){
+      int key = events->PrepareWait();
+      if(queue->Dequeue(value)){
+        events->CancelWait();
+        return true;
+      }
+      if(timeoutMicros < 0){
+        events->Wait(key, 0);
+        continue;
+      }
+      timespec now, remaining;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+      remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+      if(remaining.tv_nsec < 0){
+        remaining.tv_sec--;
+        remaining.tv_nsec += 1000000000;
+      }
+      if(remaining.tv_sec < 0){
+        events->CancelWait();
+        return queue->Dequeue(value);
+      }
+      events->Wait(key, &remaining);
+    }
+  }
+}
+
+#endif
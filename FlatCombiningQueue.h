@@ -0,0 +1,208 @@
+#ifndef FLATCOMBININGQUEUE_H
+#define FLATCOMBININGQUEUE_H
+
+#include <sched.h>
+#include <atomic>
+#include <new>
+#include <utility>
+#include "IQueue.h"
+#include "LocalRecord.h"
+#include "Futex.h"
+
+namespace ConcurrentQueues
+{
+
+// Flat combining queue (Hendler et al. 2010).  Each thread posts its
+// operation in its own publication record and then either waits for
+// it to be done or takes the combiner lock.  The combiner applies
+// every posted operation in one pass over a private linked list,
+// so the list and the lock stay in one cache while a batch of
+// operations is served, instead of bouncing between threads.
+//
+// Records are kept in Thread Local Storage, like the direct
+// Enqueue/Dequeue of LocklessQueue, and reused once their thread
+// exits.  Nodes are recycled on a private free list.  Posting a
+// request releases its value to the combiner, and marking it Done
+// releases the result back; the combiner lock orders the passes.
+template<class T>
+class FlatCombiningQueue : public IQueue<T> {
+private:
+  // Request states
+  enum { Idle, PostedEnqueue, PostedDequeue, Done };
+
+  class Publications;
+
+  struct PubRec {
+    char padding0[64];
+    std::atomic<int> State;
+    bool Found; // Dequeue found a value
+    union { T Value; }; // Value to enqueue, or the value dequeued
+    char padding1[64];
+    PubRec* Next; // Set before the record is linked, then constant
+    std::atomic<bool> Active;
+    Publications* Domain; // Owner of this record
+    PubRec(Publications* domain) : State(Idle), Found(false), Next(0), Active(true), Domain(domain) {}
+    ~PubRec() {}
+  };
+
+  // Hands out publication records, reusing those of exited threads
+  class Publications {
+  public:
+    typedef PubRec Record;
+    std::atomic<PubRec*> Head;
+
+    Publications() : Head(0) {}
+
+    ~Publications() {
+      PubRec* rec = this->Head.load(std::memory_order_relaxed);
+      while(rec){
+        PubRec* next = rec->Next;
+        delete rec;
+        rec = next;
+      }
+    }
+
+    PubRec* Acquire() {
+      for(PubRec* rec = this->Head.load(std::memory_order_acquire); rec; rec = rec->Next){
+        if(rec->Active.load(std::memory_order_relaxed)) continue;
+        bool inactive = false;
+        if(!rec->Active.compare_exchange_strong(inactive, true, std::memory_order_acquire,
+                                                std::memory_order_relaxed)) continue;
+        return rec;
+      }
+      PubRec* rec = new PubRec(this);
+      PubRec* oldhead = this->Head.load(std::memory_order_relaxed);
+      do {
+        rec->Next = oldhead;
+      }while(!this->Head.compare_exchange_weak(oldhead, rec, std::memory_order_release,
+                                               std::memory_order_relaxed));
+      return rec;
+    }
+
+    // A record is always Idle between operations
+    void Release(PubRec* rec) {
+      rec->Active.store(false, std::memory_order_release);
+    }
+  };
+
+  // Waiting spins between yields
+  static const int SpinBeforeYield = 64;
+
+  Publications pubs;
+  LocalRecord<Publications> local; // Record of the calling thread
+  typedef typename LocalRecord<Publications>::Scope LocalScope;
+  char padding0[64];
+  std::atomic<int> lock; // Held by the combiner
+  char padding1[64];
+
+  // Only touched by the combiner
+  Node<T>* head;
+  Node<T>* tail;
+  Node<T>* free; // Recycled nodes
+
+  // Serves every posted request, including the combiner's own
+  void combine() {
+    for(PubRec* rec = this->pubs.Head.load(std::memory_order_acquire); rec; rec = rec->Next){
+      int state = rec->State.load(std::memory_order_acquire);
+      if(state == PostedEnqueue){
+        Node<T>* node = this->free;
+        if(node) this->free = node->Next.load(std::memory_order_relaxed);
+        else node = new Node<T>();
+        new (&node->Value) T(std::move(rec->Value));
+        rec->Value.~T();
+        node->Next.store(0, std::memory_order_relaxed);
+        this->tail->Next.store(node, std::memory_order_relaxed);
+        this->tail = node;
+      }else if(state == PostedDequeue){
+        Node<T>* node = this->head;
+        Node<T>* next = node->Next.load(std::memory_order_relaxed);
+        rec->Found = next != 0;
+        if(next){
+          new (&rec->Value) T(std::move(next->Value));
+          next->Value.~T();
+          this->head = next;
+          node->Next.store(this->free, std::memory_order_relaxed);
+          this->free = node;
+        }
+      }else{
+        continue;
+      }
+      rec->State.store(Done, std::memory_order_release);
+    }
+  }
+
+  // Waits for a combiner to serve rec, or becomes the combiner
+  void apply(PubRec* rec) {
+    while(true){
+      int unlocked = 0;
+      if(!this->lock.load(std::memory_order_relaxed) &&
+         this->lock.compare_exchange_strong(unlocked, 1, std::memory_order_acquire, std::memory_order_relaxed)){
+        this->combine();
+        this->lock.store(0, std::memory_order_release);
+        break;
+      }
+      // Someone else is combining, they might get to us.
+      // Yield now and then in case the combiner isn't running.
+      for(int spins=1; this->lock.load(std::memory_order_relaxed); spins++){
+        if(rec->State.load(std::memory_order_acquire) == Done) break;
+        if(spins % SpinBeforeYield == 0) sched_yield();
+        else CpuRelax();
+      }
+      if(rec->State.load(std::memory_order_acquire) == Done) break;
+    }
+    rec->State.store(Idle, std::memory_order_relaxed);
+  }
+
+  template<class... Args>
+  void enqueue(Args&&... args) {
+    LocalScope scope(&this->local, &this->pubs);
+    PubRec* rec = scope;
+    new (&rec->Value) T(std::forward<Args>(args)...);
+    rec->State.store(PostedEnqueue, std::memory_order_release);
+    this->apply(rec);
+  }
+
+public:
+  FlatCombiningQueue() : lock(0), free(0) {
+    Node<T>* node = new Node<T>();
+    node->Next.store(0, std::memory_order_relaxed);
+    this->head = this->tail = node;
+  }
+
+  ~FlatCombiningQueue() {
+    DeleteChain(this->head);
+    while(this->free){
+      Node<T>* next = this->free->Next.load(std::memory_order_relaxed);
+      delete this->free;
+      this->free = next;
+    }
+  }
+
+  template<class... Args>
+  void Emplace(Args&&... args) {
+    this->enqueue(std::forward<Args>(args)...);
+  }
+
+  void Enqueue(const T& value) {
+    this->enqueue(value);
+  }
+
+  void Enqueue(T&& value) {
+    this->enqueue(std::move(value));
+  }
+
+  bool Dequeue(T* value) {
+    LocalScope scope(&this->local, &this->pubs);
+    PubRec* rec = scope;
+    rec->State.store(PostedDequeue, std::memory_order_release);
+    this->apply(rec);
+    if(!rec->Found) return false;
+    *value = std::move(rec->Value);
+    rec->Value.~T();
+    return true;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace ConcurrentQueues
+{
+  // Sleeps while *addr == expected, until woken or until the
+  // relative timeout runs out (0 waits forever).  Returns 0 when
+  // woken, -1 with errno set otherwise (ETIMEDOUT, EAGAIN, EINTR).
+  inline int FutexWait(int* addr, int expected, const timespec* timeout) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, 0, 0);
+  }
+
+  // Wakes up to count threads sleeping on addr
+  inline int FutexWake(int* addr, int count) {
+    return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, 0, 0, 0);
+  }
+
+  // Tells the CPU we are in a spin loop
+  inline void CpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+  }
+}
+
+#endif
@@ -0,0 +1,373 @@
+#ifndef HAZARDPOINTERS_H
+#define HAZARDPOINTERS_H
+
+#include <sched.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "NodePool.h"
+#include "QueueStats.h"
+#include "Probes.h"
+
+// Scans work on flat vectors owned by each HPRec.  Their capacity
+// only grows when new records are added, so a scan doesn't touch
+// the allocator in the steady state.
+
+namespace ConcurrentQueues
+{
+
+// Hazard pointer reclamation (Michael 2004), used as the
+// reclamation policy of LocklessQueue.  Memory held by retired
+// nodes is bounded, but every access to a shared node has to
+// publish a hazard pointer and re-validate its source.
+//
+// Protect stores the hazard pointer seq_cst and the caller then
+// re-reads the source with a seq_cst load.  A scan issues a seq_cst
+// fence after the node was unlinked and before it reads any hazard
+// pointer.  Either the re-read sees the node unlinked and the
+// caller retries, or the scan sees the hazard pointer.  Everything
+// else is acquire/release or relaxed.
+//
+// A reclamation policy provides:
+//   Record                per thread state, with a Domain pointer
+//                         back to the policy that owns it
+//   Validates             true if Protect needs the caller to
+//                         re-read the source pointer afterwards
+//   Acquire() / Release() hand out and take back a Record
+//   Enter() / Exit()      bracket each operation, may nest
+//   Protect(rec, i, node) keep node alive until the next Protect(i)
+//   Retire(rec, node)     node is unlinked, recycle it when safe
+//   Alloc(rec)            a node from the record's pool cache
+//   Throttle(rec)         holds an enqueue back while the nodes
+//                         awaiting reclamation are over the limit
+template<class N, int K = 2>
+class HazardPointers {
+public:
+  static const bool Validates = true;
+
+  // Each thread will have a reference to one of these.
+  // These records keep state for each thread for accessing the queue.
+  struct HPRec {
+    char padding0[64];
+    std::atomic<N*> HP[K];
+    char padding1[64];
+    HPRec* Next; // Set before the record is published, then fixed
+    std::atomic<bool> Active;
+    HazardPointers* Domain; // Owner of this record
+    std::vector<N*> RetireList;
+    std::vector<N*> Hazards; // Scratch space for scan
+    NodeCache<N> Cache; // Free nodes owned by this thread
+    std::atomic<unsigned long> Unreclaimed; // RetireList size, for readers on other threads
+    unsigned long Published; // Share of the domain's Unreclaimed count
+    std::atomic<unsigned long> Bytes; // Size of the record and its vectors
+#ifdef CONCURRENTQUEUES_STATS
+    char padding2[64];
+    QueueStats Stats; // Written only by the owning thread
+    char padding3[64];
+#endif
+    HPRec(HazardPointers* domain) : Next(0), Active(true), Domain(domain),
+                                    RetireList(), Hazards(), Cache(), Unreclaimed(0), Published(0),
+                                    Bytes(sizeof(HPRec)) {
+      for(int i=0;i<K;i++)
+        this->HP[i].store(0, std::memory_order_relaxed);
+    }
+  };
+  typedef HPRec Record;
+
+private:
+  std::atomic<int> H; // Current number of hazard records
+  std::atomic<HPRec*> HeadHPRec; // First record in chain
+  NodePool<N> Pool; // Recycled nodes shared by all records
+  std::atomic<unsigned long> UnreclaimedLimit; // 0 for no limit
+  char padding0[64];
+  std::atomic<unsigned long> Unreclaimed; // Sum of the records' Published counts
+  std::atomic<unsigned long> EagerScans; // Scans started by the limit rather than R()
+  std::atomic<unsigned long> Throttles;
+  char padding1[64];
+
+  // Times Throttle yields before letting the enqueue through,
+  // so a reader that never comes back can't stop producers
+  static const int ThrottleYields = 64;
+
+  // When the size of a RetireList gets larger than this, scan is called.
+  int R(){ return this->H.load(std::memory_order_relaxed) * K; }
+
+  HPRec* first(){ return this->HeadHPRec.load(std::memory_order_acquire); }
+
+  // Keeps rec's share of Unreclaimed and its byte count up to
+  // date.  Called after scans rather than on every Retire, so the
+  // shared count lags each record by less than R() nodes.
+  void publish(HPRec* rec){
+    unsigned long size = rec->RetireList.size();
+    rec->Unreclaimed.store(size, std::memory_order_relaxed);
+    rec->Bytes.store(sizeof(HPRec) + (rec->RetireList.capacity() + rec->Hazards.capacity()) * sizeof(N*),
+                     std::memory_order_relaxed);
+    if(size == rec->Published) return;
+    this->Unreclaimed.fetch_add(size - rec->Published, std::memory_order_relaxed);
+    rec->Published = size;
+  }
+
+  // Whether the retired nodes, counting the ones rec hasn't
+  // published yet, are over the limit
+  bool overLimit(HPRec* rec){
+    unsigned long limit = this->UnreclaimedLimit.load(std::memory_order_relaxed);
+    if(!limit) return false;
+    return this->Unreclaimed.load(std::memory_order_relaxed) + rec->RetireList.size() - rec->Published > limit;
+  }
+
+  // Make sure the vectors can hold everything a scan
+  // needs for the current number of records.  After a scan
+  // at most R() nodes survive, so 2*R() is enough to reach
+  // the next scan without growing.
+  void reserve(HPRec* rec){
+    size_t r = this->R();
+    if(rec->RetireList.capacity() < 2*r)
+      rec->RetireList.reserve(2*r);
+    if(rec->Hazards.capacity() < r)
+      rec->Hazards.reserve(r);
+    this->publish(rec);
+  }
+
+  // Try to release any unrefenced nodes by
+  // scanning the HPRec chain
+  void scan(HPRec* rec, HPRec* head){
+    this->reserve(rec);
+    QUEUE_STAT(rec, Scans, 1);
+    QUEUE_PROBE3(scan_start, this, rec, rec->RetireList.size());
+
+    // Part 1:
+    // Find any nodes that are currently in use and
+    // sort them so they can be binary searched.  The fence
+    // orders the unlinking of every retired node before
+    // the hazard pointers are read, see the top of the file.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::vector<N*>& plist = rec->Hazards;
+    plist.clear();
+    HPRec* hprec = head;
+    while(hprec){
+      for(int i=0; i<K;i++) {
+        N* hptr = hprec->HP[i].load(std::memory_order_acquire);
+        if(hptr) plist.push_back(hptr);
+      }
+      hprec = hprec->Next;
+    }
+    std::sort(plist.begin(), plist.end());
+
+    // Part 2:
+    // Run through the RetireList and recycle any
+    // that aren't referenced in Part 1, compacting
+    // the survivors to the front of the list
+    std::vector<N*>& rlist = rec->RetireList;
+    size_t kept = 0;
+    for(size_t i=0;i<rlist.size();i++){
+      N* node = rlist[i];
+      if(std::binary_search(plist.begin(), plist.end(), node)){
+        rlist[kept++] = node;
+      }else{
+        this->Pool.Free(&rec->Cache, node);
+      }
+    }
+    QUEUE_STAT(rec, ScanFreed, rlist.size() - kept);
+    QUEUE_PROBE3(scan_done, this, rec, rlist.size() - kept);
+    rlist.resize(kept);
+    this->publish(rec);
+  }
+
+  // Takes over an inactive record along with everything its
+  // last owner left in it
+  static bool claim(HPRec* hprec){
+    if(hprec->Active.load(std::memory_order_relaxed)) return false;
+    bool inactive = false;
+    return hprec->Active.compare_exchange_strong(inactive, true, std::memory_order_acquire,
+                                                 std::memory_order_relaxed);
+  }
+
+  // This will move retired nodes from inactive records
+  // into an active record so they can be relased
+  void helpscan(HPRec* rec){
+    QUEUE_STAT(rec, HelpScans, 1);
+    for(HPRec* hprec = this->first(); hprec; hprec = hprec->Next){
+      if(!claim(hprec)) continue;
+      while(!hprec->RetireList.empty()){
+        N* node = hprec->RetireList.back();
+        hprec->RetireList.pop_back();
+        rec->RetireList.push_back(node);
+        HPRec* head = this->first();
+        if((int)rec->RetireList.size() >= this->R())
+          this->scan(rec, head);
+      }
+      this->publish(hprec);
+      hprec->Active.store(false, std::memory_order_release);
+    }
+  }
+
+public:
+  HazardPointers(int prewarm = 0) : H(0), HeadHPRec(0), Pool(prewarm), UnreclaimedLimit(0),
+                                    Unreclaimed(0), EagerScans(0), Throttles(0) {}
+
+  ~HazardPointers() {
+    HPRec* hprec = this->HeadHPRec.load(std::memory_order_relaxed);
+    // Delete records
+    while(hprec){
+      HPRec* next = hprec->Next;
+      // Delete retired nodes in each record
+      for(size_t i=0;i<hprec->RetireList.size();i++)
+        delete hprec->RetireList[i];
+      this->Pool.Drain(&hprec->Cache);
+      delete hprec;
+      hprec = next;
+    }
+  }
+
+  // Allocates a new Hazard Record for a new thread
+  HPRec* Acquire() {
+    // First try to reuse an old one that is not active anymore
+    for(HPRec* hprec = this->first(); hprec; hprec = hprec->Next){
+      if(!claim(hprec)) continue;
+      this->reserve(hprec);
+      QUEUE_STAT(hprec, RecordReuses, 1);
+      QUEUE_PROBE2(hprec_reuse, this, hprec);
+      return hprec;
+    }
+
+    // Didn't find any old ones, so increment total count
+    int count = this->H.fetch_add(K, std::memory_order_relaxed) + K;
+
+    // Create a new one
+    HPRec* hprec = new HPRec(this);
+    this->reserve(hprec);
+
+    // Add it to the HPRec chain
+    HPRec* oldhead = this->HeadHPRec.load(std::memory_order_relaxed);
+    do {
+      hprec->Next = oldhead;
+    }while(!this->HeadHPRec.compare_exchange_weak(oldhead, hprec, std::memory_order_release,
+                                                  std::memory_order_relaxed));
+
+    QUEUE_PROBE3(hprec_alloc, this, hprec, count);
+    (void)count; // Only read by the probe
+    return hprec;
+  }
+
+  // Instead of deleting a record when done,
+  // just deactivate it for possible reuse
+  void Release(HPRec* hprec) {
+    for(int i=0;i<K;i++)
+      hprec->HP[i].store(0, std::memory_order_release);
+    this->Pool.Release(&hprec->Cache);
+    hprec->Active.store(false, std::memory_order_release);
+  }
+
+  // Hazard pointers are published per access,
+  // there is nothing to do per operation.
+  void Enter(HPRec*) {}
+  void Exit(HPRec*) {}
+
+  // The caller must re-read node's source with a seq_cst load
+  void Protect(HPRec* rec, int i, N* node) {
+    rec->HP[i].store(node, std::memory_order_seq_cst);
+  }
+
+  // Retire, instead of freeing immediately.
+  // The node may be referenced by another record.
+  void Retire(HPRec* rec, N* node) {
+    if(rec->RetireList.size() == rec->RetireList.capacity())
+      this->reserve(rec);
+    rec->RetireList.push_back(node);
+    rec->Unreclaimed.store(rec->RetireList.size(), std::memory_order_relaxed);
+    QUEUE_STAT_MAX(rec, RetireHighWater, rec->RetireList.size());
+    HPRec* head = this->first();
+    if((int)rec->RetireList.size() >= this->R()) {
+      this->scan(rec, head);
+      this->helpscan(rec);
+    }else if(this->overLimit(rec)) {
+      // Over the limit, scan now rather than waiting for R()
+      this->EagerScans.fetch_add(1, std::memory_order_relaxed);
+      this->scan(rec, head);
+      this->helpscan(rec);
+    }
+  }
+
+  // Backpressure for producers.  While over the limit it scans what
+  // this thread can reach and yields to the threads whose lists or
+  // hazard pointers hold the rest, ThrottleYields times at most.
+  void Throttle(HPRec* rec) {
+    if(!this->overLimit(rec)) return;
+    this->Throttles.fetch_add(1, std::memory_order_relaxed);
+    for(int i=0;i<ThrottleYields && this->overLimit(rec);i++){
+      this->EagerScans.fetch_add(1, std::memory_order_relaxed);
+      this->scan(rec, this->first());
+      this->helpscan(rec);
+      sched_yield();
+    }
+  }
+
+  // Bounds the retired nodes awaiting reclamation across all
+  // records, 0 to remove the bound.  Hazard pointers can only
+  // free what no thread protects, so the bound is soft: past it,
+  // Retire scans eagerly and Throttle holds producers back.
+  void SetUnreclaimedLimit(unsigned long nodes) {
+    this->UnreclaimedLimit.store(nodes, std::memory_order_relaxed);
+  }
+
+  N* Alloc(HPRec* rec) {
+    return this->Pool.Alloc(&rec->Cache);
+  }
+
+  // Totals of node allocations served by the pool (hits)
+  // and by new (misses) across all records.  Counters are
+  // per record, so this is only exact when the queue is idle.
+  void GetPoolStats(unsigned long* hits, unsigned long* misses) {
+    *hits = 0;
+    *misses = 0;
+    for(HPRec* hprec = this->first(); hprec; hprec = hprec->Next){
+      *hits += hprec->Cache.Hits.load(std::memory_order_relaxed);
+      *misses += hprec->Cache.Misses.load(std::memory_order_relaxed);
+    }
+  }
+
+  // Totals over every record.  LiveNodes counts nodes handed out
+  // by Alloc that are neither retired nor recycled, so the owner
+  // has to add any it allocated itself, such as a first sentinel.
+  void GetMemoryStats(MemoryStats* out) {
+    *out = MemoryStats();
+    unsigned long allocs = 0, frees = 0;
+    for(HPRec* hprec = this->first(); hprec; hprec = hprec->Next){
+      out->Records++;
+      out->RecordBytes += hprec->Bytes.load(std::memory_order_relaxed);
+      out->RetiredNodes += hprec->Unreclaimed.load(std::memory_order_relaxed);
+      unsigned long misses = hprec->Cache.Misses.load(std::memory_order_relaxed);
+      allocs += hprec->Cache.Hits.load(std::memory_order_relaxed) + misses;
+      frees += hprec->Cache.Frees.load(std::memory_order_relaxed);
+      out->AllocatedNodes += misses;
+    }
+    out->AllocatedNodes += this->Pool.Prewarmed();
+    out->LiveNodes = allocs - frees - out->RetiredNodes;
+    out->NodeBytes = out->AllocatedNodes * sizeof(N);
+    out->UnreclaimedLimit = this->UnreclaimedLimit.load(std::memory_order_relaxed);
+    out->EagerReclaims = this->EagerScans.load(std::memory_order_relaxed);
+    out->Throttles = this->Throttles.load(std::memory_order_relaxed);
+  }
+
+  // Adds up the counters of every record, see QueueStats.h.
+  // Returns false if they weren't compiled in.
+  bool GetStats(QueueStatsSnapshot* out) {
+    *out = QueueStatsSnapshot();
+    for(HPRec* hprec = this->first(); hprec; hprec = hprec->Next){
+#ifdef CONCURRENTQUEUES_STATS
+      out->Totals.Add(hprec->Stats);
+#endif
+      out->Records++;
+    }
+    out->HazardPointers = this->H.load(std::memory_order_relaxed);
+#ifdef CONCURRENTQUEUES_STATS
+    return true;
+#else
+    return false;
+#endif
+  }
+};
+
+}
+
+#endif
@@ -1,24 +1,71 @@
 #ifndef IQUEUE_H
 #define IQUEUE_H
 
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+
 namespace ConcurrentQueues
 {
   template <class T> 
   class IQueue {
   public:
-    // Adds a value to the queue
-    virtual void Enqueue(T value) = 0;
+    // Adds a copy of value to the queue
+    virtual void Enqueue(const T& value) = 0;
+    // Adds value to the queue, moving from it
+    virtual void Enqueue(T&& value) = 0;
+    // Adds a value constructed from args.  Queues
+    // hide this with one that constructs in place.
+    template<class... Args>
+    void Emplace(Args&&... args) {
+      this->Enqueue(T(std::forward<Args>(args)...));
+    }
     // Returns true, pops and fills in *value if
     // the queue is non-empty, false otherwise
     virtual bool Dequeue(T *value) = 0;
+    // Adds count values in order.  Queues override this
+    // to link the whole batch in one step.
+    virtual void EnqueueBulk(const T* values, size_t count) {
+      for(size_t i=0;i<count;i++)
+        this->Enqueue(values[i]);
+    }
+    // Pops up to max values into values and
+    // returns how many were popped
+    virtual size_t DequeueBulk(T* values, size_t max) {
+      size_t n = 0;
+      while(n < max && this->Dequeue(&values[n]))
+        n++;
+      return n;
+    }
     virtual ~IQueue(){}
   };
 
+  // Value is raw storage: it is constructed when the node is
+  // enqueued and destroyed when it is dequeued, so T needs no
+  // default constructor and a sentinel node never holds one.
+  // Next is atomic because LocklessQueue links nodes concurrently;
+  // queues that only touch it under a lock use relaxed accesses.
   template<class T> 
   struct Node {
-    T Value;
-    Node<T> *Next;
+    union { T Value; };
+    std::atomic<Node<T>*> Next;
+    Node() {}
+    ~Node() {}
   };
+
+  // Deletes a chain of nodes starting at a sentinel,
+  // destroying the values held by the nodes after it.
+  template<class T>
+  void DeleteChain(Node<T>* node) {
+    Node<T>* next = node->Next.load(std::memory_order_relaxed);
+    delete node;
+    while(next){
+      node = next;
+      next = node->Next.load(std::memory_order_relaxed);
+      node->Value.~T();
+      delete node;
+    }
+  }
 }
 
 #endif
@@ -0,0 +1,168 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+namespace ConcurrentQueues
+{
+  // Nanoseconds since some fixed point, never goes backwards
+  inline uint64_t MonotonicNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+  }
+
+  // Cheap timestamps for timing single operations.  Reads the time
+  // stamp counter when the CPU says it ticks at a constant rate, and
+  // CLOCK_MONOTONIC otherwise.  Ticks are turned into nanoseconds
+  // only when results are reported.
+  class CycleClock {
+  private:
+    struct State {
+      bool UseTsc;
+      double NanosPerTick;
+      State();
+    };
+
+    static State& state() {
+      static State s;
+      return s;
+    }
+
+#if defined(__i386__) || defined(__x86_64__)
+    // Both flags are needed for the counter to be usable as a clock
+    static bool invariantTsc() {
+      FILE* f = fopen("/proc/cpuinfo", "r");
+      if(!f) return false;
+      char line[4096];
+      bool constant = false, nonstop = false;
+      while(fgets(line, sizeof(line), f)){
+        if(strncmp(line, "flags", 5) != 0) continue;
+        constant = strstr(line, " constant_tsc") != 0;
+        nonstop = strstr(line, " nonstop_tsc") != 0;
+        break;
+      }
+      fclose(f);
+      return constant && nonstop;
+    }
+#endif
+
+  public:
+    static uint64_t Now() {
+#if defined(__i386__) || defined(__x86_64__)
+      if(state().UseTsc) return __builtin_ia32_rdtsc();
+#endif
+      return MonotonicNanos();
+    }
+
+    static double NanosPerTick() { return state().NanosPerTick; }
+
+    static const char* Source() { return state().UseTsc ? "tsc" : "monotonic"; }
+  };
+
+  // Measures the counter against CLOCK_MONOTONIC over about 20ms
+  inline CycleClock::State::State() : UseTsc(false), NanosPerTick(1.0) {
+#if defined(__i386__) || defined(__x86_64__)
+    if(!invariantTsc()) return;
+    uint64_t ns0 = MonotonicNanos();
+    uint64_t t0 = __builtin_ia32_rdtsc();
+    uint64_t ns1;
+    do { ns1 = MonotonicNanos(); } while(ns1 - ns0 < 20000000);
+    uint64_t t1 = __builtin_ia32_rdtsc();
+    if(t1 <= t0) return;
+    this->UseTsc = true;
+    this->NanosPerTick = (double)(ns1 - ns0) / (double)(t1 - t0);
+#endif
+  }
+
+  // Log-linear histogram in the style of HdrHistogram.  Values below
+  // 2*SubBuckets are counted exactly; above that every power of two
+  // is split into SubBuckets linear buckets, so a value is off by at
+  // most 1/SubBuckets (about 3%).  The counts are a fixed array, so
+  // Record never allocates.  Each thread records into its own
+  // histogram and they are merged after the threads are joined.
+  class LatencyHistogram {
+  public:
+    static const int SubBits = 5;
+    static const int SubBuckets = 1 << SubBits;
+    static const int BucketCount = (64 - SubBits) * SubBuckets + SubBuckets;
+
+  private:
+    uint64_t counts[BucketCount];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+
+    static int bucketOf(uint64_t v) {
+      if(v < 2*SubBuckets) return (int)v;
+      int shift = 63 - __builtin_clzll(v) - SubBits;
+      return shift * SubBuckets + (int)(v >> shift);
+    }
+
+    // Smallest and largest value counted in bucket i
+    static uint64_t lowestIn(int i) {
+      if(i < 2*SubBuckets) return i;
+      int shift = i / SubBuckets - 1;
+      return (uint64_t)(i % SubBuckets + SubBuckets) << shift;
+    }
+
+    static uint64_t highestIn(int i) {
+      if(i < 2*SubBuckets) return i;
+      int shift = i / SubBuckets - 1;
+      return lowestIn(i) + ((uint64_t)1 << shift) - 1;
+    }
+
+  public:
+    LatencyHistogram() { this->Reset(); }
+
+    void Reset() {
+      memset(this->counts, 0, sizeof(this->counts));
+      this->total = 0;
+      this->min = UINT64_MAX;
+      this->max = 0;
+    }
+
+    void Record(uint64_t value) {
+      this->counts[bucketOf(value)]++;
+      this->total++;
+      if(value < this->min) this->min = value;
+      if(value > this->max) this->max = value;
+    }
+
+    void Merge(const LatencyHistogram& other) {
+      for(int i=0;i<BucketCount;i++)
+        this->counts[i] += other.counts[i];
+      this->total += other.total;
+      if(other.min < this->min) this->min = other.min;
+      if(other.max > this->max) this->max = other.max;
+    }
+
+    uint64_t Count() const { return this->total; }
+    uint64_t Min() const { return this->total ? this->min : 0; }
+    uint64_t Max() const { return this->max; }
+
+    // Smallest value that at least fraction p of the recorded
+    // values are at or below, reported as the top of its bucket
+    // but never above the largest value actually seen.
+    uint64_t Percentile(double p) const {
+      if(this->total == 0) return 0;
+      uint64_t rank = (uint64_t)(p * this->total + 0.5);
+      if(rank < 1) rank = 1;
+      if(rank > this->total) rank = this->total;
+      uint64_t seen = 0;
+      for(int i=0;i<BucketCount;i++){
+        seen += this->counts[i];
+        if(seen >= rank){
+          uint64_t v = highestIn(i);
+          return v < this->max ? v : this->max;
+        }
+      }
+      return this->max;
+    }
+  };
+}
+
+#endif
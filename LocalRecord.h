@@ -0,0 +1,98 @@
+#ifndef LOCALRECORD_H
+#define LOCALRECORD_H
+
+#include <atomic>
+#include <pthread.h>
+#include "Futex.h"
+
+namespace ConcurrentQueues
+{
+  // Keeps the calling thread's reclamation record for one queue
+  // in Thread Local Storage.  The record is acquired the first
+  // time a thread asks for it and released when the thread exits.
+  // Records need a Domain pointer back to their reclaimer.
+  //
+  // The pthread key is only created the first time a thread uses
+  // the queue directly, so queues used through accessors don't
+  // hold one.  Keys are a limited resource (PTHREAD_KEYS_MAX); when
+  // none can be had, every call acquires a record of its own and
+  // releases it when done, which is slower but still correct.
+  template<class Reclaimer>
+  class LocalRecord {
+  private:
+    typedef typename Reclaimer::Record Record;
+
+    // Key states
+    enum { Unkeyed, Creating, Keyed, Keyless };
+
+    pthread_key_t key;
+    std::atomic<int> state;
+
+    // Runs at thread exit for threads that used the queue
+    static void release(void* rec) {
+      Record* r = static_cast<Record*>(rec);
+      r->Domain->Release(r);
+    }
+
+    // Creates the key on first use, returns false if there is none
+    bool keyed() {
+      int s = this->state.load(std::memory_order_acquire);
+      if(s == Unkeyed && this->state.compare_exchange_strong(s, Creating, std::memory_order_acquire,
+                                                             std::memory_order_acquire)){
+        s = pthread_key_create(&this->key, &LocalRecord::release) == 0 ? Keyed : Keyless;
+        this->state.store(s, std::memory_order_release);
+      }
+      while(s == Creating){
+        CpuRelax();
+        s = this->state.load(std::memory_order_acquire);
+      }
+      return s == Keyed;
+    }
+
+  public:
+    // The calling thread's record for the length of one call.  A
+    // record that couldn't be kept in Thread Local Storage is only
+    // borrowed, and released again when the Scope ends.
+    class Scope {
+    private:
+      Reclaimer* reclaimer;
+      Record* rec;
+      bool borrowed;
+      Scope(const Scope&);
+      Scope& operator=(const Scope&);
+
+    public:
+      Scope(LocalRecord* local, Reclaimer* reclaimer) : reclaimer(reclaimer), rec(0), borrowed(false) {
+        if(local->keyed()){
+          this->rec = static_cast<Record*>(pthread_getspecific(local->key));
+          if(this->rec) return;
+          this->rec = reclaimer->Acquire();
+          this->borrowed = pthread_setspecific(local->key, this->rec) != 0;
+        }else{
+          this->rec = reclaimer->Acquire();
+          this->borrowed = true;
+        }
+      }
+
+      ~Scope() {
+        if(this->borrowed) this->reclaimer->Release(this->rec);
+      }
+
+      operator Record*() const { return this->rec; }
+
+      // False if the record goes away with the Scope
+      bool Kept() const { return !this->borrowed; }
+    };
+
+    LocalRecord() : state(Unkeyed) {}
+
+    // Threads must be done with the queue by now; their
+    // records are freed along with the reclaimer.
+    ~LocalRecord() {
+      if(this->state.load(std::memory_order_relaxed) == Keyed)
+        pthread_key_delete(this->key);
+    }
+  };
+}
+
+#endif
@@ -2,62 +2,149 @@
 #define LOCKINGQUEUE_H
 
 #include <pthread.h>
+#include <new>
+#include <utility>
 #include "IQueue.h"
+#include "EventCount.h"
+#include "Locks.h"
+#include "Probes.h"
 
 namespace ConcurrentQueues
 {
-  template<class T>  
+  // Two lock queue (Michael and Scott 1996).  Producers serialize
+  // on enqLock and consumers on deqLock; the lock type is a policy
+  // from Locks.h, pthread_mutex_t by default.  A consumer can read
+  // the Next a producer is linking under the other lock, so that
+  // store is a release and consumers load Next with acquire.
+  template<class T, class Mutex = PthreadMutex>
   class LockingQueue : public IQueue<T> {			
   private:
-    pthread_mutex_t enqMutex;
-    pthread_mutex_t deqMutex;
+    Mutex enqLock;
+    Mutex deqLock;
     Node<T>* head;
     Node<T>* tail; 
+    EventCount events; // Wakes consumers blocked in Dequeue
+    int spinLimit; // Adaptive spin before blocking
+    
+    // Takes mutex between lock_wait probes, so a tracer
+    // can see how long each thread waited for it
+    void lock(Mutex& mutex) {
+      QUEUE_PROBE2(lock_wait_start, this, &mutex);
+      mutex.Lock();
+      QUEUE_PROBE2(lock_wait_done, this, &mutex);
+    }
     
   public:
-    LockingQueue() {
+    LockingQueue() : spinLimit(128) {
       Node<T> *node = new Node<T>();
-      node->Next = 0;
+      node->Next.store(0, std::memory_order_relaxed);
       head = tail = node;
-      pthread_mutex_init(&enqMutex,0);
-      pthread_mutex_init(&deqMutex,0);
     }		
     
     ~LockingQueue() {
-      pthread_mutex_destroy(&enqMutex);
-      pthread_mutex_destroy(&deqMutex);
-      Node<T>* node = head;
-      while(node){
-        Node<T>* next = node->Next;
-        delete node;
-        node = next;
-      }
+      DeleteChain(head);
     }
 
-    void Enqueue(T value) {
+    // The value is constructed before taking the lock
+    template<class... Args>
+    void Emplace(Args&&... args) {
+      QUEUE_PROBE2(enqueue_start, this, 1);
       Node<T>* node = new Node<T>();
-      node->Value = value;
-      node->Next = 0;
-      pthread_mutex_lock(&enqMutex);
-      tail->Next = node;
+      new (&node->Value) T(std::forward<Args>(args)...);
+      node->Next.store(0, std::memory_order_relaxed);
+      lock(enqLock);
+      tail->Next.store(node, std::memory_order_release);
       tail = node;
-      pthread_mutex_unlock(&enqMutex);
+      enqLock.Unlock();
+      events.Notify();
+      QUEUE_PROBE2(enqueue_done, this, 1);
+    }
+
+    void Enqueue(const T& value) {
+      this->Emplace(value);
+    }
+
+    void Enqueue(T&& value) {
+      this->Emplace(std::move(value));
+    }
+
+    // Builds the chain before taking the lock,
+    // then links it with one acquisition
+    void EnqueueBulk(const T* values, size_t count) {
+      if(count == 0) return;
+      QUEUE_PROBE2(enqueue_start, this, count);
+      Node<T>* first = new Node<T>();
+      new (&first->Value) T(values[0]);
+      Node<T>* last = first;
+      for(size_t i=1;i<count;i++){
+        Node<T>* node = new Node<T>();
+        new (&node->Value) T(values[i]);
+        last->Next.store(node, std::memory_order_relaxed);
+        last = node;
+      }
+      last->Next.store(0, std::memory_order_relaxed);
+      lock(enqLock);
+      tail->Next.store(first, std::memory_order_release);
+      tail = last;
+      enqLock.Unlock();
+      events.Notify(count);
+      QUEUE_PROBE2(enqueue_done, this, count);
     }
 
     bool Dequeue(T* value) {
-      pthread_mutex_lock(&deqMutex);
+      QUEUE_PROBE2(dequeue_start, this, 1);
+      lock(deqLock);
       Node<T>* node = head;
-      Node<T>* next = node->Next;
+      Node<T>* next = node->Next.load(std::memory_order_acquire);
       if(!next) {
-        pthread_mutex_unlock(&deqMutex);
+        deqLock.Unlock();
+        QUEUE_PROBE1(dequeue_empty, this);
+        QUEUE_PROBE2(dequeue_done, this, 0);
         return false;
       }
-      *value = next->Value;
+      *value = std::move(next->Value);
+      next->Value.~T();
       head = next;
-      pthread_mutex_unlock(&deqMutex);
+      deqLock.Unlock();
       delete node;
+      QUEUE_PROBE2(dequeue_done, this, 1);
       return true;
     }
+
+    // Waits up to timeoutMicros for a value, returns false
+    // if none arrived in time
+    bool Dequeue(T* value, long timeoutMicros) {
+      return BlockingDequeue(this, &events, &spinLimit, value, timeoutMicros);
+    }
+
+    // Waits as long as it takes for a value
+    void WaitDequeue(T* value) {
+      BlockingDequeue(this, &events, &spinLimit, value, -1);
+    }
+
+    // Advances head across up to max nodes under one
+    // acquisition, and frees them after unlocking
+    size_t DequeueBulk(T* values, size_t max) {
+      QUEUE_PROBE2(dequeue_start, this, max);
+      size_t n = 0;
+      lock(deqLock);
+      Node<T>* node = head;
+      while(n < max && head->Next.load(std::memory_order_acquire)){
+        head = head->Next.load(std::memory_order_relaxed);
+        values[n++] = std::move(head->Value);
+        head->Value.~T();
+      }
+      Node<T>* last = head;
+      deqLock.Unlock();
+      while(node != last){
+        Node<T>* next = node->Next.load(std::memory_order_relaxed);
+        delete node;
+        node = next;
+      }
+      if(n == 0) QUEUE_PROBE1(dequeue_empty, this);
+      QUEUE_PROBE2(dequeue_done, this, n);
+      return n;
+    }
   };
 }
 
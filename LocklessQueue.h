@@ -1,87 +1,249 @@
 #ifndef LOCKLESSQUEUE_H
 #define LOCKLESSQUEUE_H
 
-#include <list>
-#include <map>
+#include <pthread.h>
+#include <atomic>
+#include <new>
+#include <utility>
 #include "IQueue.h"
+#include "HazardPointers.h"
+#include "EpochReclamation.h"
+#include "EventCount.h"
+#include "LocalRecord.h"
+#include "Probes.h"
 #include <stdio.h>
-#define CAS(a,x,y) __sync_bool_compare_and_swap(a,x,y)
-
-using std::list;
-using std::map;
-
-// I'm not sure if using stl containers is a performance hit
-// at this level.  They are only really used in scan operations
-// which are infrequent.  After some testing, we can manually
-// implement these if they are problematic.
 
 namespace ConcurrentQueues
 {
 
-template<class T> 
+// Michael and Scott's lock free queue.  Memory reclamation is
+// a policy: HazardPointers (the default) bounds the memory held
+// by retired nodes, EpochReclamation drops the per access hazard
+// pointer stores and re-validation for more throughput.
+//
+// Orderings: the CAS that links a node onto Tail->Next is seq_cst
+// so it is ordered before NotifyAfterBarrier reads the waiter
+// count, and the CAS that unlinks from Head is seq_cst so the
+// reclaimer's checks that follow in Retire see the node gone.
+// Re-reads that validate a hazard pointer are seq_cst, see
+// HazardPointers.h.  Loads that go on to read a node are acquire,
+// pairing with the release (or seq_cst) CAS that published it.
+template<class T, class Reclaimer = HazardPointers<Node<T> > >
 class LocklessQueue {
 private:
+  typedef typename Reclaimer::Record Record;
+  typedef typename LocalRecord<Reclaimer>::Scope LocalScope;
+
+  Reclaimer reclaimer; // Per thread records and retired nodes
+  std::atomic<Node<T>*> Tail; // Tail of the queue
+  std::atomic<Node<T>*> Head; // Head of the queue
+  EventCount events; // Wakes consumers blocked in Dequeue
+  int spinLimit; // Adaptive spin before blocking
+  
+  LocalRecord<Reclaimer> local; // Record of the calling thread, if any
+
+  // Order of the re-reads that validate a Protect
+  static const std::memory_order Validate = Reclaimer::Validates ? std::memory_order_seq_cst :
+                                                                   std::memory_order_acquire;
 
-  // Max number of Hazard Pointers per HPRec, Queues need 2
-  static const int K = 2;
-  
-  // Each ThreadAccessor will have a reference to one of these.
-  // These records keep state for each thread for accessing the queue.
-  struct HPRec {
-    char padding0[64];
-    Node<T>* HP[K];
-    char padding1[64];
-    HPRec* Next;
-    bool Active;
-    list<Node<T>*> RetireList;
-    HPRec() : HP(), Next(0), Active(true), RetireList() {}
-  };    
-  
-  int H; // Current number of hazard records
-  HPRec* HeadHPRec; // First record in chain
-  Node<T>* Tail; // Tail of the queue
-  Node<T>* Head; // Head of the queue
-  
-  // When the size of a RetireList gets larger than this, scan is called.
-  int R(){ return this->H * this->K; }
-  
-  // Allocates a new Hazard Record for a new thread
-  HPRec* allocateHPRec() {
-    // First try to reuse an old one that is not active anymore
-    for(HPRec* hprec = this->HeadHPRec; hprec; hprec = hprec->Next){
-      if(hprec->Active) continue;
-      if(!CAS(&hprec->Active, false, true)) continue;
-      return hprec;
-    }  
-  
-    // Didn't find any old ones, so increment total count
-    int oldcount;
-    do { oldcount = this->H; }
-    while(!CAS(&this->H, oldcount, oldcount+K));
-  
-    // Create a new one
-    HPRec* hprec = new HPRec();
+  // CAS that leaves expected alone when it fails
+  static bool cas(std::atomic<Node<T>*>& target, Node<T>* expected, Node<T>* desired,
+                  std::memory_order order) {
+    return target.compare_exchange_strong(expected, desired, order, std::memory_order_relaxed);
+  }
+  
+  // Lockless Enqueue, constructs the value in place
+  template<class... Args>
+  void enqueue(Record* rec, Args&&... args) {
+    QUEUE_PROBE2(enqueue_start, this, 1);
+    Reclaimer& r = this->reclaimer;
+    r.Throttle(rec);
+    r.Enter(rec);
+    Node<T>* node = r.Alloc(rec);
+    new (&node->Value) T(std::forward<Args>(args)...);
+    node->Next.store(0, std::memory_order_relaxed);
     
-    // Add it to the HPRec chain
-    HPRec* oldhead;
-    do {
-      oldhead = this->HeadHPRec;
-      hprec->Next = oldhead;
-    }while(!CAS(&this->HeadHPRec, oldhead, hprec));
+    Node<T>* t;
+    Node<T>* next;
+    while(true){
+      t = this->Tail.load(std::memory_order_acquire);
+      r.Protect(rec, 0, t);
+      if(Reclaimer::Validates && this->Tail.load(Validate) != t){ QUEUE_STAT(rec, EnqueueRetries, 1); continue; }
+      next = t->Next.load(std::memory_order_acquire);
+      if(this->Tail.load(std::memory_order_relaxed) != t){ QUEUE_STAT(rec, EnqueueRetries, 1); continue; }
+      if(next){
+        if(cas(this->Tail, t, next, std::memory_order_release)) QUEUE_STAT(rec, TailFixups, 1);
+        QUEUE_STAT(rec, EnqueueRetries, 1);
+        continue;
+      }
+      if(cas(t->Next, 0, node, std::memory_order_seq_cst)) break;
+      QUEUE_PROBE1(enqueue_cas_retry, this);
+      QUEUE_STAT(rec, EnqueueCasFailures, 1);
+      QUEUE_STAT(rec, EnqueueRetries, 1);
+    }
+    cas(this->Tail, t, node, std::memory_order_release);
+    r.Exit(rec);
+    this->events.NotifyAfterBarrier();
+    QUEUE_PROBE2(enqueue_done, this, 1);
+  }
   
-    return hprec;
+  // Lockless Dequeue.  The value is only moved out once the
+  // CAS has made next the new sentinel, which belongs to this
+  // thread until its value is gone and stays protected.
+  bool dequeue(Record* rec, T* value) {
+    Reclaimer& r = this->reclaimer;
+    Node<T>* h;
+    Node<T>* t;
+    Node<T>* next;
+    QUEUE_PROBE2(dequeue_start, this, 1);
+    r.Enter(rec);
+    while(true){
+      h = this->Head.load(std::memory_order_acquire);
+      r.Protect(rec, 0, h);
+      if(Reclaimer::Validates && this->Head.load(Validate) != h){ QUEUE_STAT(rec, DequeueRetries, 1); continue; }
+      t = this->Tail.load(std::memory_order_acquire);
+      next = h->Next.load(std::memory_order_acquire);
+      r.Protect(rec, 1, next);
+      if(this->Head.load(Validate) != h){ QUEUE_STAT(rec, DequeueRetries, 1); continue; }
+      if(!next){
+        r.Exit(rec);
+        QUEUE_PROBE1(dequeue_empty, this);
+        QUEUE_PROBE2(dequeue_done, this, 0);
+        return false;
+      }
+      if(h == t){
+        if(cas(this->Tail, t, next, std::memory_order_release)) QUEUE_STAT(rec, TailFixups, 1);
+        QUEUE_STAT(rec, DequeueRetries, 1);
+        continue;
+      }
+      if(cas(this->Head, h, next, std::memory_order_seq_cst)) break;
+      QUEUE_PROBE1(dequeue_cas_retry, this);
+      QUEUE_STAT(rec, DequeueCasFailures, 1);
+      QUEUE_STAT(rec, DequeueRetries, 1);
+    }
+    *value = std::move(next->Value);
+    next->Value.~T();
+    r.Retire(rec, h);
+    r.Exit(rec);
+    QUEUE_PROBE2(dequeue_done, this, 1);
+    return true;
   }
   
-  // Instead of deleting a record when done, 
-  // just deactivate it for possible reuse
-  void retireHPRec(HPRec* hprec) {
-    for(int i=0;i<K;i++)
-      hprec->HP[i] = 0;
-    hprec->Active = false;
+  // Builds a private chain of nodes and links
+  // all of it with a single CAS on Tail->Next
+  void enqueueBulk(Record* rec, const T* values, size_t count) {
+    if(count == 0) return;
+    QUEUE_PROBE2(enqueue_start, this, count);
+    Reclaimer& r = this->reclaimer;
+    r.Throttle(rec);
+    r.Enter(rec);
+    Node<T>* first = r.Alloc(rec);
+    new (&first->Value) T(values[0]);
+    Node<T>* last = first;
+    for(size_t i=1;i<count;i++){
+      Node<T>* node = r.Alloc(rec);
+      new (&node->Value) T(values[i]);
+      last->Next.store(node, std::memory_order_relaxed);
+      last = node;
+    }
+    last->Next.store(0, std::memory_order_relaxed);
+    
+    Node<T>* t;
+    Node<T>* next;
+    while(true){
+      t = this->Tail.load(std::memory_order_acquire);
+      r.Protect(rec, 0, t);
+      if(Reclaimer::Validates && this->Tail.load(Validate) != t){ QUEUE_STAT(rec, EnqueueRetries, 1); continue; }
+      next = t->Next.load(std::memory_order_acquire);
+      if(this->Tail.load(std::memory_order_relaxed) != t){ QUEUE_STAT(rec, EnqueueRetries, 1); continue; }
+      if(next){
+        if(cas(this->Tail, t, next, std::memory_order_release)) QUEUE_STAT(rec, TailFixups, 1);
+        QUEUE_STAT(rec, EnqueueRetries, 1);
+        continue;
+      }
+      if(cas(t->Next, 0, first, std::memory_order_seq_cst)) break;
+      QUEUE_PROBE1(enqueue_cas_retry, this);
+      QUEUE_STAT(rec, EnqueueCasFailures, 1);
+      QUEUE_STAT(rec, EnqueueRetries, 1);
+    }
+    // Others may already be helping Tail along the chain
+    cas(this->Tail, t, last, std::memory_order_release);
+    r.Exit(rec);
+    this->events.NotifyAfterBarrier(count);
+    QUEUE_PROBE2(enqueue_done, this, count);
+  }
+  
+  // Finds up to max nodes after Head, never passing the Tail
+  // that was read, moves Head across all of them with a single
+  // CAS and then moves their values out.
+  size_t dequeueBulk(Record* rec, T* values, size_t max) {
+    if(max == 0) return 0;
+    Reclaimer& r = this->reclaimer;
+    Node<T>* h;
+    Node<T>* t;
+    Node<T>* next;
+    Node<T>* last;
+    size_t n;
+    QUEUE_PROBE2(dequeue_start, this, max);
+    r.Enter(rec);
+    while(true){
+      h = this->Head.load(std::memory_order_acquire);
+      r.Protect(rec, 0, h);
+      if(Reclaimer::Validates && this->Head.load(Validate) != h){ QUEUE_STAT(rec, DequeueRetries, 1); continue; }
+      t = this->Tail.load(std::memory_order_acquire);
+      next = h->Next.load(std::memory_order_acquire);
+      r.Protect(rec, 1, next);
+      if(this->Head.load(Validate) != h){ QUEUE_STAT(rec, DequeueRetries, 1); continue; }
+      if(!next){
+        r.Exit(rec);
+        QUEUE_PROBE1(dequeue_empty, this);
+        QUEUE_PROBE2(dequeue_done, this, 0);
+        return 0;
+      }
+      if(h == t){
+        if(cas(this->Tail, t, next, std::memory_order_release)) QUEUE_STAT(rec, TailFixups, 1);
+        QUEUE_STAT(rec, DequeueRetries, 1);
+        continue;
+      }
+      last = next;
+      n = 1;
+      // While Head is still h none of the nodes after it
+      // have been retired, so each one is safe to read
+      // once it is protected and Head is re-checked.
+      bool moved = false;
+      while(n < max && last != t){
+        Node<T>* succ = last->Next.load(std::memory_order_acquire);
+        if(!succ) break;
+        r.Protect(rec, 1, succ);
+        if(this->Head.load(Validate) != h){ moved = true; break; }
+        n++;
+        last = succ;
+      }
+      if(moved){ QUEUE_STAT(rec, DequeueRetries, 1); continue; }
+      if(cas(this->Head, h, last, std::memory_order_seq_cst)) break;
+      QUEUE_PROBE1(dequeue_cas_retry, this);
+      QUEUE_STAT(rec, DequeueCasFailures, 1);
+      QUEUE_STAT(rec, DequeueRetries, 1);
+    }
+    // last is the new sentinel, everything before it is ours.
+    // The links were read with acquire above, relaxed will do.
+    Node<T>* node = h;
+    for(size_t i=0;i<n;i++){
+      Node<T>* succ = node->Next.load(std::memory_order_relaxed);
+      values[i] = std::move(succ->Value);
+      succ->Value.~T();
+      r.Retire(rec, node);
+      node = succ;
+    }
+    r.Exit(rec);
+    QUEUE_PROBE2(dequeue_done, this, n);
+    return n;
   }
   
   // Each thread that needs to use the queue will 
-  // access it through an instance of this object
+  // access it through an instance of this object,
+  // or through the Enqueue/Dequeue methods below
+  // which keep the record in Thread Local Storage.
   
   // This is a FRIEND class, so it can access the
   // private members of LocklessQueue.  It is also
@@ -93,151 +255,61 @@ private:
   // class explicitly when created.
   class ThreadAccessor : public IQueue<T> {
   private:
-    LocklessQueue<T>* queue;
-    HPRec* hprec; 
+    LocklessQueue<T, Reclaimer>* queue;
+    Record* rec; 
     
-    // Try to release any unrefenced nodes by
-    // scanning the HPRec chain
-    void scan(HPRec* head){    
-      // Part 1:
-      // Find any nodes that are currently in use
-      map<Node<T>*,bool> plist;      
-      HPRec* hprec = head;
-      while(hprec){
-        for(int i=0; i<this->queue->K;i++) {
-          Node<T>* hptr = hprec->HP[i];
-          if(hptr) plist[hptr] = true;
-        }
-        hprec = hprec->Next;
-      }
-      
-      // Part 2:
-      // Run through the RetireList and delete any
-      // that aren't referenced in Part 1
-      list<Node<T>*> tmplist;
-      tmplist.swap(this->hprec->RetireList);
-      while(!tmplist.empty()){
-        Node<T>* node = tmplist.front();      
-        tmplist.pop_front();      
-        if(plist.count(node)){
-          this->hprec->RetireList.push_back(node);
-        }else{
-          delete node;
-        }
-      }
+  public:
+    ThreadAccessor(LocklessQueue<T, Reclaimer>* queue) : queue(queue) {
+      this->rec = this->queue->reclaimer.Acquire();
     }
     
-    // This will move retired nodes from inactive records
-    // into an active record so they can be relased
-    void helpscan(){
-      for(HPRec* hprec = this->queue->HeadHPRec; hprec; hprec = hprec->Next){
-        if(hprec->Active) continue;
-        if(!CAS(&hprec->Active, false, true)) continue;
-        while(!hprec->RetireList.empty()){
-          Node<T>* node = hprec->RetireList.front();
-          hprec->RetireList.pop_front();
-          this->hprec->RetireList.push_back(node);
-          HPRec* head = this->queue->HeadHPRec;
-          if((int)this->hprec->RetireList.size() >= this->queue->R())
-            this->scan(head);
-        }
-      }
+    ~ThreadAccessor() {
+      this->queue->reclaimer.Release(this->rec);
     }
     
-    // Retire, instead of freeing immediately.
-    // The node may be referenced by another record.
-    void retireNode(Node<T>* node) {
-      this->hprec->RetireList.push_back(node);
-      HPRec* head = this->queue->HeadHPRec;
-      if((int)this->hprec->RetireList.size() >= this->queue->R()) {
-        this->scan(head);
-        this->helpscan();
-      }
+    void BeginBatch() { this->queue->reclaimer.Enter(this->rec); }
+    void EndBatch() { this->queue->reclaimer.Exit(this->rec); }
+    
+    void Enqueue(const T& value) {
+      this->queue->enqueue(this->rec, value);
     }
     
-  public:
-    ThreadAccessor(LocklessQueue<T>* queue) : queue(queue) {
-      this->hprec = this->queue->allocateHPRec();
+    void Enqueue(T&& value) {
+      this->queue->enqueue(this->rec, std::move(value));
     }
+
     
-    ~ThreadAccessor() {
-      this->queue->retireHPRec(this->hprec);
+    bool Dequeue(T* value) {
+      return this->queue->dequeue(this->rec, value);
     }
     
-    // Lockless Enqueue
-    void Enqueue(T value) {
-      Node<T>* node = new Node<T>();
-      node->Value = value;
-      node->Next = 0;
-      
-      Node<T>* t;
-      Node<T>* next;
-      while(true){
-        t = this->queue->Tail;
-        this->hprec->HP[0] = t;
-        if(this->queue->Tail != t) continue;
-        next = t->Next;
-        if(this->queue->Tail != t) continue;
-        if(next){ CAS(&this->queue->Tail, t, next); continue; }
-        if(CAS(&t->Next, 0, node)) break;
-      }
-      CAS(&this->queue->Tail, t, node);
+    void EnqueueBulk(const T* values, size_t count) {
+      this->queue->enqueueBulk(this->rec, values, count);
     }
     
-    // Lockless Dequeue
-    bool Dequeue(T* value) {
-      Node<T>* h;
-      Node<T>* t;
-      Node<T>* next;
-      while(true){
-        h = this->queue->Head;
-        this->hprec->HP[0] = h;
-        if(this->queue->Head != h) continue;
-        t = this->queue->Tail;
-        next = h->Next;
-        this->hprec->HP[1] = next;
-        if(this->queue->Head != h) continue;
-        if(!next) return false;
-        if(h == t){ CAS(&this->queue->Tail, t, next); continue; }
-        *value = next->Value;
-        if(CAS(&this->queue->Head, h, next)) break;
-      }
-      this->retireNode(h);
-      return true;
+    size_t DequeueBulk(T* values, size_t max) {
+      return this->queue->dequeueBulk(this->rec, values, max);
     }
   };
   
   friend class ThreadAccessor;
 
 public:
-  LocklessQueue() : H(0), HeadHPRec(0) {
+  // prewarm nodes are allocated into the pool up front
+  LocklessQueue(int prewarm = 0) : reclaimer(prewarm), spinLimit(128) {
     //Create a sentinel node initially.
     Node<T> *node = new Node<T>();
-    node->Next = 0;
-    this->Head = this->Tail = node;  
+    node->Next.store(0, std::memory_order_relaxed);
+    this->Head.store(node, std::memory_order_relaxed);
+    this->Tail.store(node, std::memory_order_relaxed);
   }
   
+  // Records and retired nodes are deleted by the reclaimer.
+  // Threads that used the queue directly must not touch it
+  // once this has started.
   ~LocklessQueue() {
-    HPRec* hprec = this->HeadHPRec;
-    // Delete records
-    while(hprec){
-      HPRec* next = hprec->Next;
-      // Delete retired nodes in each record
-      while(!hprec->RetireList.empty()){
-        Node<T>* node = hprec->RetireList.front();
-        hprec->RetireList.pop_front();
-        delete node;
-      }
-      delete hprec;
-      hprec = next;
-    }
     // Delete nodes in queue
-    Node<T>* node = this->Head;
-    while(node){
-      Node<T>* next = node->Next;
-      delete node;
-      node = next;
-    }
+    DeleteChain(this->Head.load(std::memory_order_relaxed));
   }
   
   // Returns a pointer that should be freed
@@ -245,6 +317,110 @@ public:
   IQueue<T>* CreateAccessor() {
     return new ThreadAccessor(this);
   }  
+  
+  // Enqueue and Dequeue for the calling thread without an accessor.
+  // The thread's record is acquired on first use and released
+  // automatically when the thread exits.
+  void Enqueue(const T& value) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    this->enqueue(rec, value);
+  }
+  
+  void Enqueue(T&& value) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    this->enqueue(rec, std::move(value));
+  }
+  
+  template<class... Args>
+  void Emplace(Args&&... args) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    this->enqueue(rec, std::forward<Args>(args)...);
+  }
+  
+  bool Dequeue(T* value) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    return this->dequeue(rec, value);
+  }
+  
+  void EnqueueBulk(const T* values, size_t count) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    this->enqueueBulk(rec, values, count);
+  }
+  
+  // Waits up to timeoutMicros for a value, returns false
+  // if none arrived in time.  Spins, then sleeps in the
+  // kernel; producers only make a syscall when someone sleeps.
+  bool Dequeue(T* value, long timeoutMicros) {
+    return BlockingDequeue(this, &this->events, &this->spinLimit, value, timeoutMicros);
+  }
+  
+  // Waits as long as it takes for a value
+  void WaitDequeue(T* value) {
+    BlockingDequeue(this, &this->events, &this->spinLimit, value, -1);
+  }
+  
+  size_t DequeueBulk(T* values, size_t max) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    return this->dequeueBulk(rec, values, max);
+  }
+  
+  // Batch brackets for the calling thread's own record.  Without
+  // a thread local record there is nothing to keep pinned, so
+  // every operation pins on its own.
+  void BeginBatch() {
+    LocalScope rec(&this->local, &this->reclaimer);
+    if(rec.Kept()) this->reclaimer.Enter(rec);
+  }
+  
+  void EndBatch() {
+    LocalScope rec(&this->local, &this->reclaimer);
+    if(rec.Kept()) this->reclaimer.Exit(rec);
+  }
+  
+  // Keeps an accessor inside one reclamation critical section
+  // across several operations, so EpochReclamation pins once per
+  // batch instead of once per operation.  Calls must be paired.
+  void BeginBatch(IQueue<T>* accessor) {
+    static_cast<ThreadAccessor*>(accessor)->BeginBatch();
+  }
+  
+  void EndBatch(IQueue<T>* accessor) {
+    static_cast<ThreadAccessor*>(accessor)->EndBatch();
+  }
+  
+  // Totals of node allocations served by the pool (hits)
+  // and by new (misses) across all records.  Counters are
+  // per record, so this is only exact when the queue is idle.
+  void GetPoolStats(unsigned long* hits, unsigned long* misses) {
+    this->reclaimer.GetPoolStats(hits, misses);
+  }
+  
+  // A soft target for the retired nodes waiting to be recycled.
+  // Past it, dequeues reclaim eagerly and enqueues yield a while
+  // to let a stalled reader finish; 0, the default, is unbounded.
+  // With epochs a reader stalled while pinned blocks reclamation,
+  // so the target can't be enforced until it moves on.
+  void SetUnreclaimedLimit(unsigned long nodes) {
+    this->reclaimer.SetUnreclaimedLimit(nodes);
+  }
+  
+  // Memory held by the queue, for monitoring.  Only exact
+  // when the queue is idle.
+  void GetMemoryStats(MemoryStats* out) {
+    this->reclaimer.GetMemoryStats(out);
+    // The first sentinel was allocated directly
+    long live = (long)out->LiveNodes + 1;
+    out->LiveNodes = live > 0 ? live : 0;
+    out->AllocatedNodes++;
+    out->NodeBytes += sizeof(Node<T>);
+  }
+  
+  // Contention and reclamation counters summed over all records.
+  // Returns false, with only the record counts filled in, unless
+  // built with CONCURRENTQUEUES_STATS; see QueueStats.h.
+  bool GetStats(QueueStatsSnapshot* out) {
+    return this->reclaimer.GetStats(out);
+  }
 };
 
 }
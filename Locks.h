@@ -0,0 +1,234 @@
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Futex.h"
+
+// Lock policies for LockingQueue.  A lock provides Lock() and
+// Unlock(), is default constructible and is never copied.
+
+namespace ConcurrentQueues
+{
+  // Exponential backoff for spin loops.  Once the delay has grown
+  // to MaxDelay pauses the thread yields instead, so a lock holder
+  // that was descheduled gets to run.
+  class Backoff {
+  private:
+    int delay;
+    static const int MaxDelay = 1024;
+
+  public:
+    Backoff() : delay(1) {}
+
+    void Pause() {
+      if(this->delay >= MaxDelay){
+        sched_yield();
+        return;
+      }
+      for(int i=0;i<this->delay;i++)
+        CpuRelax();
+      this->delay <<= 1;
+    }
+  };
+
+  // pthread_mutex_t, which sleeps in the kernel under contention
+  class PthreadMutex {
+  private:
+    pthread_mutex_t mutex;
+    PthreadMutex(const PthreadMutex&);
+    PthreadMutex& operator=(const PthreadMutex&);
+
+  public:
+    PthreadMutex() { pthread_mutex_init(&this->mutex, 0); }
+    ~PthreadMutex() { pthread_mutex_destroy(&this->mutex); }
+    void Lock() { pthread_mutex_lock(&this->mutex); }
+    void Unlock() { pthread_mutex_unlock(&this->mutex); }
+  };
+
+  // Test-and-test-and-set: waiters spin reading the flag in their
+  // own cache and only try the exchange once it looks free.
+  class TTASLock {
+  private:
+    char padding0[64];
+    int locked;
+    char padding1[64];
+    TTASLock(const TTASLock&);
+    TTASLock& operator=(const TTASLock&);
+
+  public:
+    TTASLock() : locked(0) {}
+
+    void Lock() {
+      Backoff backoff;
+      while(true){
+        while(__atomic_load_n(&this->locked, __ATOMIC_RELAXED))
+          CpuRelax();
+        if(!__sync_lock_test_and_set(&this->locked, 1)) return;
+        backoff.Pause();
+      }
+    }
+
+    void Unlock() {
+      __sync_lock_release(&this->locked);
+    }
+  };
+
+  // FIFO spin lock.  Each waiter backs off in proportion
+  // to how many tickets are ahead of it.  Handoff is strictly in
+  // order, so a waiter also yields after SpinBeforeYield rounds in
+  // case the thread whose turn it is isn't running.
+  class TicketLock {
+  private:
+    char padding0[64];
+    unsigned next; // Next ticket to hand out
+    unsigned serving; // Ticket that holds the lock
+    char padding1[64];
+    TicketLock(const TicketLock&);
+    TicketLock& operator=(const TicketLock&);
+
+    // Yield if this many tickets are ahead, the holder
+    // or someone queued before us is probably not running
+    static const unsigned YieldDistance = 4;
+    static const int SpinBeforeYield = 16;
+
+  public:
+    TicketLock() : next(0), serving(0) {}
+
+    void Lock() {
+      unsigned ticket = __sync_fetch_and_add(&this->next, 1);
+      for(int spins=1;;spins++){
+        unsigned ahead = ticket - __atomic_load_n(&this->serving, __ATOMIC_ACQUIRE);
+        if(ahead == 0) return;
+        if(ahead >= YieldDistance || spins % SpinBeforeYield == 0){
+          sched_yield();
+          continue;
+        }
+        for(unsigned i=0;i<ahead*64;i++)
+          CpuRelax();
+      }
+    }
+
+    void Unlock() {
+      __atomic_store_n(&this->serving, this->serving + 1, __ATOMIC_RELEASE);
+    }
+  };
+
+  // MCS queue lock (Mellor-Crummey and Scott 1991).  Each waiter
+  // spins on a flag in its own queue node, so a release touches
+  // only the next waiter's cache line.  Queue nodes come from a
+  // small per thread stack: a thread can hold at most MaxHeld MCS
+  // locks at once and must release them in reverse order.  Taking
+  // one more aborts the process.
+  class MCSLock {
+  private:
+    struct QNode {
+      QNode* Next;
+      int Waiting;
+      char padding[64];
+    };
+
+    static const int MaxHeld = 8;
+
+    char padding0[64];
+    QNode* tail; // Last thread in line
+    char padding1[64];
+    QNode* holder; // Node of the thread holding the lock
+    char padding2[64];
+    MCSLock(const MCSLock&);
+    MCSLock& operator=(const MCSLock&);
+
+    // Per thread stack of queue nodes, one for each MCS lock held
+    static QNode* nodes() {
+      static __thread QNode stack[MaxHeld];
+      return stack;
+    }
+
+    static int& depth() {
+      static __thread int held = 0;
+      return held;
+    }
+
+  public:
+    MCSLock() : tail(0), holder(0) {}
+
+    void Lock() {
+      if(depth() >= MaxHeld){
+        fprintf(stderr, "MCSLock: a thread can hold at most %d MCS locks\n", MaxHeld);
+        abort();
+      }
+      QNode* node = &nodes()[depth()++];
+      __atomic_store_n(&node->Next, (QNode*)0, __ATOMIC_RELAXED);
+      __atomic_store_n(&node->Waiting, 1, __ATOMIC_RELAXED);
+      // Releases the reset node along with publishing it
+      QNode* prev = __atomic_exchange_n(&this->tail, node, __ATOMIC_ACQ_REL);
+      if(prev){
+        __atomic_store_n(&prev->Next, node, __ATOMIC_RELEASE);
+        Backoff backoff;
+        while(__atomic_load_n(&node->Waiting, __ATOMIC_ACQUIRE))
+          backoff.Pause();
+      }
+      this->holder = node;
+    }
+
+    void Unlock() {
+      QNode* node = this->holder;
+      QNode* next = __atomic_load_n(&node->Next, __ATOMIC_ACQUIRE);
+      if(!next){
+        if(__sync_bool_compare_and_swap(&this->tail, node, (QNode*)0)){
+          depth()--;
+          return;
+        }
+        // Someone swapped in behind us and is about to link
+        while(!(next = __atomic_load_n(&node->Next, __ATOMIC_ACQUIRE)))
+          CpuRelax();
+      }
+      __atomic_store_n(&next->Waiting, 0, __ATOMIC_RELEASE);
+      depth()--;
+    }
+  };
+
+  // Spins for a while, then sleeps on a futex (Drepper, "Futexes
+  // Are Tricky", mutex 2).  Unlock only makes a syscall when a
+  // thread may be sleeping.
+  class AdaptiveLock {
+  private:
+    char padding0[64];
+    int state; // 0 unlocked, 1 locked, 2 locked with sleepers
+    char padding1[64];
+    AdaptiveLock(const AdaptiveLock&);
+    AdaptiveLock& operator=(const AdaptiveLock&);
+
+    static const int SpinLimit = 100;
+
+  public:
+    AdaptiveLock() : state(0) {}
+
+    void Lock() {
+      for(int i=0;i<SpinLimit;i++){
+        if(!__atomic_load_n(&this->state, __ATOMIC_RELAXED) &&
+           __sync_bool_compare_and_swap(&this->state, 0, 1))
+          return;
+        CpuRelax();
+      }
+      int c = __sync_val_compare_and_swap(&this->state, 0, 1);
+      if(c == 0) return;
+      if(c != 2) c = __atomic_exchange_n(&this->state, 2, __ATOMIC_ACQUIRE);
+      while(c != 0){
+        FutexWait(&this->state, 2, 0);
+        c = __atomic_exchange_n(&this->state, 2, __ATOMIC_ACQUIRE);
+      }
+    }
+
+    void Unlock() {
+      if(__sync_fetch_and_sub(&this->state, 1) != 1){
+        __atomic_store_n(&this->state, 0, __ATOMIC_RELEASE);
+        FutexWake(&this->state, 1);
+      }
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include "IQueue.h"
+
+namespace ConcurrentQueues
+{
+  // Link embedded in every object that goes through an MPSCQueue.
+  // An object can be in at most one such queue at a time.
+  struct MPSCHook {
+    MPSCHook* Next;
+    MPSCHook() : Next(0) {}
+  };
+
+  // Intrusive multi-producer/single-consumer queue (Vyukov).  T must
+  // derive from MPSCHook; the queue links the objects themselves, so
+  // nothing is allocated and nothing needs reclaiming.  Enqueue is one
+  // atomic exchange.  Dequeue uses only loads and stores, except for
+  // one exchange when it takes the last object and re-inserts the
+  // stub.  Only one thread may ever dequeue.  The caller owns the
+  // objects and must keep them alive until they are dequeued.
+  //
+  // Dequeue can return false while a producer is between its exchange
+  // and linking its object, even if earlier objects are queued behind
+  // it.  They show up once that producer finishes its Enqueue.
+  template<class T>
+  class MPSCQueue : public IQueue<T*> {
+  private:
+    char padding0[64];
+    MPSCHook* head; // Last object enqueued, swapped by producers
+    char padding1[64];
+    MPSCHook* tail; // Next object to dequeue, consumer only
+    MPSCHook stub; // Keeps the list non empty
+    char padding2[64];
+
+    // The exchange releases the cleared Next, so a later producer's
+    // link into hook can't be overwritten by it.
+    void push(MPSCHook* hook) {
+      __atomic_store_n(&hook->Next, (MPSCHook*)0, __ATOMIC_RELAXED);
+      MPSCHook* prev = __atomic_exchange_n(&this->head, hook, __ATOMIC_ACQ_REL);
+      __atomic_store_n(&prev->Next, hook, __ATOMIC_RELEASE);
+    }
+
+  public:
+    MPSCQueue() {
+      this->head = this->tail = &this->stub;
+    }
+
+    void Enqueue(T* const& value) {
+      this->push(value);
+    }
+
+    void Enqueue(T*&& value) {
+      this->push(value);
+    }
+
+    // Consumer only
+    bool Dequeue(T** value) {
+      MPSCHook* t = this->tail;
+      MPSCHook* next = __atomic_load_n(&t->Next, __ATOMIC_ACQUIRE);
+      if(t == &this->stub){
+        if(!next) return false;
+        this->tail = t = next;
+        next = __atomic_load_n(&t->Next, __ATOMIC_ACQUIRE);
+      }
+      if(next){
+        this->tail = next;
+        *value = static_cast<T*>(t);
+        return true;
+      }
+      // t is the last object.  It can only be taken once
+      // something, the stub if need be, is linked after it.
+      if(t != __atomic_load_n(&this->head, __ATOMIC_ACQUIRE)) return false;
+      this->push(&this->stub);
+      next = __atomic_load_n(&t->Next, __ATOMIC_ACQUIRE);
+      if(!next) return false;
+      this->tail = next;
+      *value = static_cast<T*>(t);
+      return true;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <atomic>
+
+namespace ConcurrentQueues
+{
+  // Free nodes are linked through their Next field, which may or
+  // may not be atomic.  Only the thread holding a free chain walks
+  // it, and chains change hands through globalFree, so the links
+  // themselves need no ordering.
+  template<class N>
+  inline N* FreeNext(N* const& next) { return next; }
+
+  template<class N>
+  inline N* FreeNext(const std::atomic<N*>& next) { return next.load(std::memory_order_relaxed); }
+
+  template<class N>
+  inline void SetFreeNext(N*& next, N* value) { next = value; }
+
+  template<class N>
+  inline void SetFreeNext(std::atomic<N*>& next, N* value) { next.store(value, std::memory_order_relaxed); }
+
+  // Per thread cache of free nodes.  Only the owning thread
+  // touches it, so no synchronization is needed.  The counters
+  // record how often Alloc was served without calling new, and
+  // how many nodes came back through Free.  Stats read them from
+  // other threads, so they are atomic, but with a single writer a
+  // relaxed load and store is enough to bump them.
+  template<class N>
+  struct NodeCache {
+    N* FreeList;
+    int Count;
+    std::atomic<unsigned long> Hits;
+    std::atomic<unsigned long> Misses;
+    std::atomic<unsigned long> Frees;
+    NodeCache() : FreeList(0), Count(0), Hits(0), Misses(0), Frees(0) {}
+
+    static void Bump(std::atomic<unsigned long>& counter) {
+      counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+  };
+
+  // Memory held by a queue and its reclamation policy, summed over
+  // the per thread records, so it is only exact when the queue is
+  // idle.  Nodes are never handed back to the allocator while the
+  // queue lives, so AllocatedNodes is also the high-water mark.
+  struct MemoryStats {
+    unsigned long LiveNodes; // Linked into the queue, sentinel included
+    unsigned long RetiredNodes; // Unlinked but not yet recycled
+    unsigned long AllocatedNodes; // Ever taken from new, pooled ones included
+    unsigned long NodeBytes; // AllocatedNodes times the node size
+    unsigned long Records; // Per thread records
+    unsigned long RecordBytes; // Records and the vectors they own
+    unsigned long UnreclaimedLimit; // 0 if there is none
+    unsigned long EagerReclaims; // Reclaim passes forced by the limit
+    unsigned long Throttles; // Enqueues held back by the limit
+    MemoryStats() : LiveNodes(0), RetiredNodes(0), AllocatedNodes(0), NodeBytes(0), Records(0),
+                    RecordBytes(0), UnreclaimedLimit(0), EagerReclaims(0), Throttles(0) {}
+  };
+
+  // Recycles nodes instead of handing them back to the allocator.
+  // Nodes are taken from and returned to a NodeCache owned by the
+  // calling thread.  When a cache grows past CacheLimit, half of it
+  // is pushed onto a lock free global list which an empty cache
+  // will take as a whole.  No operation walks more than CacheLimit
+  // nodes that it doesn't then keep, so a thread that only frees
+  // and one that only allocates stay cheap at any list length.
+  // Whole chains are pushed and the list is only ever emptied with
+  // an exchange, so there is no ABA problem even though nodes are
+  // reused.
+  template<class N>
+  class NodePool {
+  private:
+    char padding0[64];
+    std::atomic<N*> globalFree;
+    char padding1[64];
+    int prewarmed;
+
+    // Links first..last onto the global list
+    void pushChain(N* first, N* last) {
+      N* oldhead = this->globalFree.load(std::memory_order_relaxed);
+      do {
+        SetFreeNext(last->Next, oldhead);
+      }while(!this->globalFree.compare_exchange_weak(oldhead, first, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+    }
+
+    // Refills an empty cache with the whole global list.  The cache
+    // may end up over CacheLimit; the next Free sheds the excess.
+    bool refill(NodeCache<N>* cache) {
+      if(!this->globalFree.load(std::memory_order_relaxed)) return false;
+      N* first = this->globalFree.exchange(0, std::memory_order_acquire);
+      if(!first) return false;
+      int count = 0;
+      for(N* node = first; node; node = FreeNext(node->Next))
+        count++;
+      cache->FreeList = first;
+      cache->Count = count;
+      return true;
+    }
+
+  public:
+    // Max nodes kept in a single thread's cache
+    static const int CacheLimit = 256;
+
+    // Optionally allocate prewarm nodes up front so the first
+    // operations don't have to go to the allocator either.
+    NodePool(int prewarm = 0) : globalFree(0), prewarmed(prewarm) {
+      for(int i=0;i<prewarm;i++){
+        N* node = new N();
+        SetFreeNext(node->Next, this->globalFree.load(std::memory_order_relaxed));
+        this->globalFree.store(node, std::memory_order_relaxed);
+      }
+    }
+
+    ~NodePool() {
+      N* node = this->globalFree.load(std::memory_order_relaxed);
+      while(node){
+        N* next = FreeNext(node->Next);
+        delete node;
+        node = next;
+      }
+    }
+
+    N* Alloc(NodeCache<N>* cache) {
+      if(cache->FreeList || this->refill(cache)){
+        N* node = cache->FreeList;
+        cache->FreeList = FreeNext(node->Next);
+        cache->Count--;
+        NodeCache<N>::Bump(cache->Hits);
+        return node;
+      }
+      NodeCache<N>::Bump(cache->Misses);
+      return new N();
+    }
+
+    void Free(NodeCache<N>* cache, N* node) {
+      NodeCache<N>::Bump(cache->Frees);
+      SetFreeNext(node->Next, cache->FreeList);
+      cache->FreeList = node;
+      if(++cache->Count < CacheLimit) return;
+
+      // Share the first CacheLimit/2 nodes, keep the rest
+      N* first = cache->FreeList;
+      N* last = first;
+      for(int i=1;i<CacheLimit/2;i++)
+        last = FreeNext(last->Next);
+      cache->FreeList = FreeNext(last->Next);
+      cache->Count -= CacheLimit/2;
+      this->pushChain(first, last);
+    }
+
+    // Gives every node in the cache to the global list,
+    // used when the owning thread is done with the cache.
+    void Release(NodeCache<N>* cache) {
+      N* first = cache->FreeList;
+      if(!first) return;
+      N* last = first;
+      while(FreeNext(last->Next)) last = FreeNext(last->Next);
+      cache->FreeList = 0;
+      cache->Count = 0;
+      this->pushChain(first, last);
+    }
+
+    // Nodes allocated by the constructor
+    int Prewarmed() const { return this->prewarmed; }
+
+    // Deletes every node in the cache, only safe once
+    // no other thread can use the pool.
+    void Drain(NodeCache<N>* cache) {
+      N* node = cache->FreeList;
+      while(node){
+        N* next = FreeNext(node->Next);
+        delete node;
+        node = next;
+      }
+      cache->FreeList = 0;
+      cache->Count = 0;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace ConcurrentQueues
+{
+  // Hardware counters of the calling thread through perf_event_open.
+  // Each counter is opened on its own rather than as a group, so one
+  // the CPU or the hypervisor doesn't offer doesn't take the others
+  // with it; when the kernel multiplexes them the counts are scaled
+  // up by enabled/running time.  Only user space is counted, which
+  // works at the default perf_event_paranoid setting.
+  //
+  // Hitm counts loads served by a modified line in another core's
+  // cache, the cost of a cache line moving between cores.  It is a
+  // model specific event and is only tried on Intel family 6 CPUs,
+  // where MEM_LOAD_*L3_HIT_RETIRED.XSNP_HITM is event 0xd2 umask 0x04.
+  class PerfCounters {
+  public:
+    enum { Cycles, Instructions, L1DMisses, LLCMisses, Hitm, Count };
+
+    static const char* Name(int counter) {
+      static const char* names[Count] = { "cycles", "instructions", "l1d_misses", "llc_misses", "hitm" };
+      return names[counter];
+    }
+
+  private:
+    int fds[Count];
+    int error; // errno of the first counter that failed to open
+
+    static int open(perf_event_attr* attr) {
+      attr->size = sizeof(*attr);
+      attr->disabled = 1;
+      attr->exclude_kernel = 1;
+      attr->exclude_hv = 1;
+      attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      return syscall(__NR_perf_event_open, attr, 0, -1, -1, 0);
+    }
+
+    static bool intelCore() {
+      FILE* f = fopen("/proc/cpuinfo", "r");
+      if(!f) return false;
+      char line[256];
+      bool intel = false, family6 = false;
+      while(fgets(line, sizeof(line), f)){
+        if(strncmp(line, "vendor_id", 9) == 0) intel = strstr(line, "GenuineIntel") != 0;
+        if(strncmp(line, "cpu family", 10) == 0){
+          family6 = strstr(line, ": 6\n") != 0;
+          break;
+        }
+      }
+      fclose(f);
+      return intel && family6;
+    }
+
+  public:
+    PerfCounters() : error(0) {
+      for(int i=0;i<Count;i++){
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        switch(i){
+        case Cycles:
+          attr.type = PERF_TYPE_HARDWARE;
+          attr.config = PERF_COUNT_HW_CPU_CYCLES;
+          break;
+        case Instructions:
+          attr.type = PERF_TYPE_HARDWARE;
+          attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+          break;
+        case L1DMisses:
+          attr.type = PERF_TYPE_HW_CACHE;
+          attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+          break;
+        case LLCMisses:
+          attr.type = PERF_TYPE_HARDWARE;
+          attr.config = PERF_COUNT_HW_CACHE_MISSES;
+          break;
+        case Hitm:
+          attr.type = PERF_TYPE_RAW;
+          attr.config = 0x04d2;
+          break;
+        }
+        this->fds[i] = i == Hitm && !intelCore() ? -1 : open(&attr);
+        if(this->fds[i] < 0 && !this->error) this->error = i == Hitm ? ENOENT : errno;
+      }
+    }
+
+    ~PerfCounters() {
+      for(int i=0;i<Count;i++)
+        if(this->fds[i] >= 0) close(this->fds[i]);
+    }
+
+    bool Available(int counter) const { return this->fds[counter] >= 0; }
+
+    bool AnyAvailable() const {
+      for(int i=0;i<Count;i++)
+        if(this->fds[i] >= 0) return true;
+      return false;
+    }
+
+    // Why a counter is missing, 0 if none is
+    int Error() const { return this->error; }
+
+    void Start() {
+      for(int i=0;i<Count;i++){
+        if(this->fds[i] < 0) continue;
+        ioctl(this->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(this->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+
+    void Stop() {
+      for(int i=0;i<Count;i++)
+        if(this->fds[i] >= 0) ioctl(this->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    // Scaled counts since Start, 0 for counters that are missing
+    // or never got scheduled
+    void Read(uint64_t values[Count]) const {
+      for(int i=0;i<Count;i++){
+        values[i] = 0;
+        uint64_t data[3]; // value, time enabled, time running
+        if(this->fds[i] < 0 || read(this->fds[i], data, sizeof(data)) != sizeof(data)) continue;
+        if(data[2] == 0) continue;
+        values[i] = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+      }
+    }
+  };
+}
+
+#endif
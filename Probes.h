@@ -0,0 +1,40 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes under the provider "concurrentqueues", for tracing
+// with perf, bpftrace or SystemTap, e.g.
+//
+//   bpftrace -e 'usdt:./bench:concurrentqueues:dequeue_empty { @[tid] = count(); }'
+//
+// Each probe is a single nop plus an ELF note, so they stay in
+// release builds; a tracer patches the nop when it attaches.  The
+// arguments are only registers or memory operands that are already
+// at hand.  Without <sys/sdt.h> (systemtap-sdt-dev), or with
+// CONCURRENTQUEUES_NO_PROBES defined, the probes compile to nothing.
+//
+//   enqueue_start(queue, count)       enqueue_done(queue, count)
+//   dequeue_start(queue, max)         dequeue_done(queue, got)
+//   dequeue_empty(queue)
+//   enqueue_cas_retry(queue)          dequeue_cas_retry(queue)
+//   lock_wait_start(queue, lock)      lock_wait_done(queue, lock)
+//   scan_start(domain, rec, retired)  scan_done(domain, rec, freed)
+//   hprec_alloc(domain, rec, hazards) hprec_reuse(domain, rec)
+
+#if !defined(CONCURRENTQUEUES_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CONCURRENTQUEUES_PROBES 1
+#endif
+#endif
+
+#ifdef CONCURRENTQUEUES_PROBES
+#define QUEUE_PROBE1(name, a) DTRACE_PROBE1(concurrentqueues, name, a)
+#define QUEUE_PROBE2(name, a, b) DTRACE_PROBE2(concurrentqueues, name, a, b)
+#define QUEUE_PROBE3(name, a, b, c) DTRACE_PROBE3(concurrentqueues, name, a, b, c)
+#else
+#define QUEUE_PROBE1(name, a) ((void)0)
+#define QUEUE_PROBE2(name, a, b) ((void)0)
+#define QUEUE_PROBE3(name, a, b, c) ((void)0)
+#endif
+
+#endif
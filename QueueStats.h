@@ -0,0 +1,86 @@
+#ifndef QUEUESTATS_H
+#define QUEUESTATS_H
+
+// Contention and reclamation counters for LocklessQueue and its
+// reclamation policies.  They are only compiled in when
+// CONCURRENTQUEUES_STATS is defined; otherwise QUEUE_STAT expands
+// to nothing, records carry no counters and GetStats returns false.
+//
+// Every counter lives in the record of the thread that bumps it,
+// in a block padded off from the rest of the record, so counting
+// adds no shared writes.  GetStats adds up the records on demand;
+// the totals are exact only while the queue is idle.
+
+namespace ConcurrentQueues
+{
+  struct QueueStats {
+    unsigned long EnqueueCasFailures; // Lost the race to link onto Tail->Next
+    unsigned long EnqueueRetries; // Enqueue loop restarts, for any reason
+    unsigned long DequeueCasFailures; // Lost the race to move Head
+    unsigned long DequeueRetries; // Dequeue loop restarts, for any reason
+    unsigned long TailFixups; // Lagging Tail moved on by a helping CAS
+    unsigned long Scans; // scan() calls, or epoch reclaim passes
+    unsigned long HelpScans; // helpscan() calls
+    unsigned long ScanFreed; // Nodes recycled by scans
+    unsigned long RetireHighWater; // Longest RetireList (or limbo) seen
+    unsigned long RecordReuses; // Records handed out again by Acquire
+
+    QueueStats() { this->Clear(); }
+
+    void Clear() {
+      this->EnqueueCasFailures = this->EnqueueRetries = 0;
+      this->DequeueCasFailures = this->DequeueRetries = 0;
+      this->TailFixups = 0;
+      this->Scans = this->HelpScans = this->ScanFreed = 0;
+      this->RetireHighWater = this->RecordReuses = 0;
+    }
+
+    // Reads other with relaxed loads, its owner may be counting
+    void Add(const QueueStats& other) {
+      this->EnqueueCasFailures += __atomic_load_n(&other.EnqueueCasFailures, __ATOMIC_RELAXED);
+      this->EnqueueRetries += __atomic_load_n(&other.EnqueueRetries, __ATOMIC_RELAXED);
+      this->DequeueCasFailures += __atomic_load_n(&other.DequeueCasFailures, __ATOMIC_RELAXED);
+      this->DequeueRetries += __atomic_load_n(&other.DequeueRetries, __ATOMIC_RELAXED);
+      this->TailFixups += __atomic_load_n(&other.TailFixups, __ATOMIC_RELAXED);
+      this->Scans += __atomic_load_n(&other.Scans, __ATOMIC_RELAXED);
+      this->HelpScans += __atomic_load_n(&other.HelpScans, __ATOMIC_RELAXED);
+      this->ScanFreed += __atomic_load_n(&other.ScanFreed, __ATOMIC_RELAXED);
+      this->RecordReuses += __atomic_load_n(&other.RecordReuses, __ATOMIC_RELAXED);
+      unsigned long high = __atomic_load_n(&other.RetireHighWater, __ATOMIC_RELAXED);
+      if(high > this->RetireHighWater) this->RetireHighWater = high;
+    }
+  };
+
+  // What GetStats hands back
+  struct QueueStatsSnapshot {
+    QueueStats Totals; // Summed over records, RetireHighWater is the max
+    unsigned long Records; // Records in the chain
+    unsigned long HazardPointers; // H, the hazard pointers in use, 0 for epochs
+
+    QueueStatsSnapshot() : Records(0), HazardPointers(0) {}
+
+    double FreedPerScan() const {
+      return this->Totals.Scans ? (double)this->Totals.ScanFreed / this->Totals.Scans : 0;
+    }
+  };
+
+  // Only the owning thread writes a record's counters
+  inline void StatAdd(unsigned long* counter, unsigned long n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+  }
+
+  inline void StatMax(unsigned long* counter, unsigned long value) {
+    if(value > __atomic_load_n(counter, __ATOMIC_RELAXED))
+      __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+  }
+}
+
+#ifdef CONCURRENTQUEUES_STATS
+#define QUEUE_STAT(rec, field, n) ConcurrentQueues::StatAdd(&(rec)->Stats.field, (n))
+#define QUEUE_STAT_MAX(rec, field, value) ConcurrentQueues::StatMax(&(rec)->Stats.field, (value))
+#else
+#define QUEUE_STAT(rec, field, n) ((void)0)
+#define QUEUE_STAT_MAX(rec, field, value) ((void)0)
+#endif
+
+#endif
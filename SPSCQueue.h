@@ -0,0 +1,115 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <stddef.h>
+#include <sched.h>
+#include <new>
+#include <utility>
+#include "IQueue.h"
+
+namespace ConcurrentQueues
+{
+  // Fixed capacity ring for exactly one producer thread and one
+  // consumer thread.  Each side owns its index and only publishes
+  // it with a release store, so there are no atomic RMW operations.
+  // Each side also keeps a copy of the other side's index and only
+  // re-reads the shared one when the copy says the ring is full or
+  // empty.  TryEnqueue and Dequeue are wait free.
+  template<class T>
+  class SPSCQueue : public IQueue<T> {
+  private:
+    // Value is raw storage, constructed only while
+    // the slot holds an item
+    struct Slot {
+      union { T Value; };
+      Slot() {}
+      ~Slot() {}
+    };
+
+    char padding0[64];
+    Slot* slots;
+    size_t mask;
+    char padding1[64];
+    size_t head; // Next slot to read, written by the consumer
+    size_t tailCache; // Consumer's copy of tail
+    char padding2[64];
+    size_t tail; // Next slot to write, written by the producer
+    size_t headCache; // Producer's copy of head
+    char padding3[64];
+
+    static size_t roundUp(size_t capacity) {
+      size_t size = 2;
+      while(size < capacity) size <<= 1;
+      return size;
+    }
+
+  public:
+    // Capacity is rounded up to the next power of two
+    SPSCQueue(size_t capacity) : head(0), tailCache(0), tail(0), headCache(0) {
+      size_t size = roundUp(capacity);
+      this->slots = new Slot[size];
+      this->mask = size - 1;
+    }
+
+    ~SPSCQueue() {
+      for(size_t pos = this->head; pos != this->tail; pos++)
+        this->slots[pos & this->mask].Value.~T();
+      delete[] this->slots;
+    }
+
+    size_t Capacity() const { return this->mask + 1; }
+
+    // Producer only.  Returns false without blocking if the
+    // queue is full, leaving args untouched.
+    template<class... Args>
+    bool TryEmplace(Args&&... args) {
+      size_t t = this->tail;
+      if(t - this->headCache > this->mask){
+        this->headCache = __atomic_load_n(&this->head, __ATOMIC_ACQUIRE);
+        if(t - this->headCache > this->mask) return false;
+      }
+      new (&this->slots[t & this->mask].Value) T(std::forward<Args>(args)...);
+      __atomic_store_n(&this->tail, t+1, __ATOMIC_RELEASE);
+      return true;
+    }
+
+    bool TryEnqueue(const T& value) {
+      return this->TryEmplace(value);
+    }
+
+    bool TryEnqueue(T&& value) {
+      return this->TryEmplace(std::move(value));
+    }
+
+    // Waits for the consumer if the queue is full
+    template<class... Args>
+    void Emplace(Args&&... args) {
+      while(!this->TryEmplace(std::forward<Args>(args)...))
+        sched_yield();
+    }
+
+    void Enqueue(const T& value) {
+      this->Emplace(value);
+    }
+
+    void Enqueue(T&& value) {
+      this->Emplace(std::move(value));
+    }
+
+    // Consumer only
+    bool Dequeue(T* value) {
+      size_t h = this->head;
+      if(h == this->tailCache){
+        this->tailCache = __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE);
+        if(h == this->tailCache) return false;
+      }
+      Slot* slot = &this->slots[h & this->mask];
+      *value = std::move(slot->Value);
+      slot->Value.~T();
+      __atomic_store_n(&this->head, h+1, __ATOMIC_RELEASE);
+      return true;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef SEGMENTEDQUEUE_H
+#define SEGMENTEDQUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <new>
+#include <utility>
+#include "IQueue.h"
+#include "HazardPointers.h"
+#include "LocalRecord.h"
+#include "Futex.h"
+
+namespace ConcurrentQueues
+{
+
+// A block of N cells in a SegmentedQueue.  Producers and consumers
+// claim cells with a fetch-and-add on EnqIdx and DeqIdx, so they
+// only contend on a CAS when a segment runs out.  The indices only
+// hand out cells, which are then claimed with a CAS on their State,
+// so they are relaxed; values are published by the release store
+// of Full.
+template<class T, int N>
+struct Segment {
+  // Cell states.  A consumer that gets to an Empty cell first
+  // marks it Taken, and the producer holding that index
+  // has to claim another one.
+  enum { Empty, Writing, Full, Taken };
+
+  // Value is raw storage, constructed only while the cell is Full
+  struct Cell {
+    std::atomic<int> State;
+    union { T Value; };
+    Cell() {}
+    ~Cell() {}
+  };
+
+  char padding0[64];
+  std::atomic<size_t> EnqIdx; // Next cell for producers, may run past N
+  char padding1[64];
+  std::atomic<size_t> DeqIdx; // Next cell for consumers, may run past N
+  char padding2[64];
+  std::atomic<Segment*> Next; // Next segment, also links free segments in the pool
+  Cell Cells[N];
+
+  Segment() { this->Reset(); }
+
+  // Segments come back from the pool in whatever state they were
+  // retired in, with every value already moved out.  Nobody else
+  // can see the segment until the release CAS that links it.
+  void Reset() {
+    this->EnqIdx.store(0, std::memory_order_relaxed);
+    this->DeqIdx.store(0, std::memory_order_relaxed);
+    this->Next.store(0, std::memory_order_relaxed);
+    for(int i=0;i<N;i++)
+      this->Cells[i].State.store(Empty, std::memory_order_relaxed);
+  }
+};
+
+// Unbounded lock free queue built from a linked list of segments,
+// after Correia and Ramalhete's FAAArrayQueue.  Each element costs
+// one cell instead of one node, and segments are allocated, retired
+// through HazardPointers and recycled through its pool as a whole.
+// A consumer that claims a cell whose producer is still writing
+// waits for it, just like BoundedQueue.  Head and Tail follow the
+// same orderings as LocklessQueue, see there and HazardPointers.h.
+template<class T, int N = 256>
+class SegmentedQueue {
+private:
+  typedef Segment<T, N> Seg;
+  typedef typename Seg::Cell Cell;
+  typedef HazardPointers<Seg, 1> Reclaimer;
+  typedef typename Reclaimer::Record Record;
+  typedef typename LocalRecord<Reclaimer>::Scope LocalScope;
+
+  Reclaimer reclaimer; // Per thread records and retired segments
+  char padding0[64];
+  std::atomic<Seg*> Head; // Segment consumers take from
+  char padding1[64];
+  std::atomic<Seg*> Tail; // Segment producers add to
+  char padding2[64];
+
+  LocalRecord<Reclaimer> local; // Record of the calling thread, if any
+
+  // CAS that leaves expected alone when it fails
+  template<class V>
+  static bool cas(std::atomic<V>& target, V expected, V desired, std::memory_order order) {
+    return target.compare_exchange_strong(expected, desired, order, std::memory_order_relaxed);
+  }
+
+  // Waits out a producer that is still writing.  Returns false if
+  // the cell was empty and has been marked Taken instead.
+  static bool settle(Cell* cell) {
+    while(true){
+      int state = cell->State.load(std::memory_order_acquire);
+      if(state == Seg::Full) return true;
+      if(state == Seg::Empty){
+        if(cas(cell->State, (int)Seg::Empty, (int)Seg::Taken, std::memory_order_relaxed)) return false;
+      }else{
+        CpuRelax();
+      }
+    }
+  }
+
+  template<class... Args>
+  void enqueue(Record* rec, Args&&... args) {
+    Reclaimer& r = this->reclaimer;
+    Seg* spare = 0; // New segment that hasn't been linked yet
+    while(true){
+      Seg* t = this->Tail.load(std::memory_order_acquire);
+      r.Protect(rec, 0, t);
+      if(this->Tail.load(std::memory_order_seq_cst) != t) continue;
+      size_t idx = t->EnqIdx.fetch_add(1, std::memory_order_relaxed);
+      if(idx < (size_t)N){
+        Cell* cell = &t->Cells[idx];
+        // Fails if a consumer already gave up on this cell
+        if(!cas(cell->State, (int)Seg::Empty, (int)Seg::Writing, std::memory_order_relaxed)) continue;
+        new (&cell->Value) T(std::forward<Args>(args)...);
+        cell->State.store(Seg::Full, std::memory_order_release);
+        break;
+      }
+
+      // The segment is full, move on to the next one
+      Seg* next = t->Next.load(std::memory_order_acquire);
+      if(this->Tail.load(std::memory_order_relaxed) != t) continue;
+      if(next){ cas(this->Tail, t, next, std::memory_order_release); continue; }
+      if(!spare){
+        spare = r.Alloc(rec);
+        spare->Reset();
+        // Cell 0 is ours once the segment is linked
+        spare->EnqIdx.store(1, std::memory_order_relaxed);
+        spare->Cells[0].State.store(Seg::Writing, std::memory_order_relaxed);
+      }
+      if(cas(t->Next, (Seg*)0, spare, std::memory_order_release)){
+        cas(this->Tail, t, spare, std::memory_order_release);
+        Cell* cell = &spare->Cells[0];
+        new (&cell->Value) T(std::forward<Args>(args)...);
+        cell->State.store(Seg::Full, std::memory_order_release);
+        spare = 0;
+        break;
+      }
+    }
+    // Another producer linked a segment first.  Nobody else
+    // has seen this one, retiring it just recycles it.
+    if(spare) r.Retire(rec, spare);
+  }
+
+  bool dequeue(Record* rec, T* value) {
+    Reclaimer& r = this->reclaimer;
+    while(true){
+      Seg* h = this->Head.load(std::memory_order_acquire);
+      r.Protect(rec, 0, h);
+      if(this->Head.load(std::memory_order_seq_cst) != h) continue;
+      // Don't burn indices on an empty queue
+      if(h->DeqIdx.load(std::memory_order_relaxed) >= h->EnqIdx.load(std::memory_order_relaxed) &&
+         !h->Next.load(std::memory_order_acquire)) return false;
+      size_t idx = h->DeqIdx.fetch_add(1, std::memory_order_relaxed);
+      if(idx < (size_t)N){
+        Cell* cell = &h->Cells[idx];
+        if(!settle(cell)) continue;
+        *value = std::move(cell->Value);
+        cell->Value.~T();
+        // Only the destructor looks at the cell after this
+        cell->State.store(Seg::Taken, std::memory_order_relaxed);
+        return true;
+      }
+
+      // Every cell has been claimed, move on to the next segment
+      Seg* next = h->Next.load(std::memory_order_acquire);
+      if(!next) return false;
+      // Head must not pass Tail, or a retired segment
+      // could still be reached through Tail
+      Seg* t = this->Tail.load(std::memory_order_acquire);
+      if(h == t){ cas(this->Tail, t, next, std::memory_order_release); continue; }
+      if(cas(this->Head, h, next, std::memory_order_release))
+        r.Retire(rec, h);
+    }
+  }
+
+  // Per thread access to the queue, see LocklessQueue
+  class ThreadAccessor : public IQueue<T> {
+  private:
+    SegmentedQueue<T, N>* queue;
+    Record* rec;
+
+  public:
+    ThreadAccessor(SegmentedQueue<T, N>* queue) : queue(queue) {
+      this->rec = this->queue->reclaimer.Acquire();
+    }
+
+    ~ThreadAccessor() {
+      this->queue->reclaimer.Release(this->rec);
+    }
+
+    void Enqueue(const T& value) {
+      this->queue->enqueue(this->rec, value);
+    }
+
+    void Enqueue(T&& value) {
+      this->queue->enqueue(this->rec, std::move(value));
+    }
+
+    bool Dequeue(T* value) {
+      return this->queue->dequeue(this->rec, value);
+    }
+  };
+
+  friend class ThreadAccessor;
+
+public:
+  // prewarm segments are allocated into the pool up front
+  SegmentedQueue(int prewarm = 0) : reclaimer(prewarm) {
+    Seg* seg = new Seg();
+    this->Head.store(seg, std::memory_order_relaxed);
+    this->Tail.store(seg, std::memory_order_relaxed);
+  }
+
+  // Destroys values still in the queue.  Threads that used
+  // the queue directly must not touch it once this has started.
+  ~SegmentedQueue() {
+    Seg* seg = this->Head.load(std::memory_order_relaxed);
+    while(seg){
+      Seg* next = seg->Next.load(std::memory_order_relaxed);
+      for(int i=0;i<N;i++)
+        if(seg->Cells[i].State.load(std::memory_order_relaxed) == Seg::Full)
+          seg->Cells[i].Value.~T();
+      delete seg;
+      seg = next;
+    }
+  }
+
+  // Returns a pointer that should be freed
+  // when not being used any longer.
+  IQueue<T>* CreateAccessor() {
+    return new ThreadAccessor(this);
+  }
+
+  // Enqueue and Dequeue for the calling thread without an accessor.
+  // The thread's record is acquired on first use and released
+  // automatically when the thread exits.
+  void Enqueue(const T& value) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    this->enqueue(rec, value);
+  }
+
+  void Enqueue(T&& value) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    this->enqueue(rec, std::move(value));
+  }
+
+  template<class... Args>
+  void Emplace(Args&&... args) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    this->enqueue(rec, std::forward<Args>(args)...);
+  }
+
+  bool Dequeue(T* value) {
+    LocalScope rec(&this->local, &this->reclaimer);
+    return this->dequeue(rec, value);
+  }
+
+  // Segment allocations served by the pool (hits) and by
+  // new (misses), only exact when the queue is idle.
+  void GetPoolStats(unsigned long* hits, unsigned long* misses) {
+    this->reclaimer.GetPoolStats(hits, misses);
+  }
+
+  // Reclamation counters of the segment hazard pointers,
+  // see QueueStats.h
+  bool GetStats(QueueStatsSnapshot* out) {
+    return this->reclaimer.GetStats(out);
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef SHARDEDQUEUE_H
+#define SHARDEDQUEUE_H
+
+#include <atomic>
+#include <utility>
+#include "IQueue.h"
+
+namespace ConcurrentQueues
+{
+  // Small number for the calling thread, handed out in the order
+  // threads first ask for one and shared by every ShardedQueue.
+  inline unsigned ThreadSlot() {
+    static unsigned nextSlot = 0;
+    static __thread unsigned slot = 0; // 0 until assigned, slots start at 1
+    if(!slot) slot = __sync_add_and_fetch(&nextSlot, 1);
+    return slot - 1;
+  }
+
+  // How Dequeue looks for values when the home shard is empty
+  enum ShardPolicy {
+    ShardTwoChoice, // the fuller of two random shards, then every shard
+    ShardRoundRobin // every shard in turn, starting after the home shard
+  };
+
+  // Relaxed FIFO queue spread over several sub-queues.  A thread
+  // enqueues to and dequeues from its home shard and only steals
+  // from the others when that is empty, so threads on different
+  // shards never share a cache line.  Values from one producer
+  // come out in order as long as they come out of its home shard;
+  // there is no order between producers.  Dequeue returns false
+  // only after every shard has looked empty.  With shards that can
+  // be full, Enqueue tries every other shard before it waits for
+  // room in the home shard.
+  //
+  // Shard is any queue whose Enqueue and Dequeue are safe to call
+  // from several threads without an accessor: LockingQueue,
+  // LocklessQueue, SegmentedQueue or BoundedQueue.
+  template<class T, class Shard>
+  class ShardedQueue : public IQueue<T> {
+  private:
+    // Size is an estimate used to skip empty shards while stealing,
+    // so it only needs relaxed updates
+    struct ShardSlot {
+      char padding0[64];
+      Shard* Queue;
+      std::atomic<long> Size;
+      char padding1[64];
+    };
+
+    ShardSlot* shards;
+    int count;
+    ShardPolicy policy;
+
+    int home() {
+      return ThreadSlot() % this->count;
+    }
+
+    // xorshift, per thread
+    static unsigned nextRandom() {
+      static __thread unsigned state = 0;
+      if(!state) state = ThreadSlot() * 2654435761u + 1;
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      return state;
+    }
+
+    bool take(int i, T* value) {
+      ShardSlot& s = this->shards[i];
+      if(!s.Queue->Dequeue(value)) return false;
+      s.Size.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    // Shards that can be full, such as BoundedQueue, have a
+    // TryEnqueue that leaves the value alone when it fails
+    template<class S>
+    static auto bounded(S* shard, int) -> decltype(shard->TryEnqueue(std::declval<const T&>()), true) {
+      return true;
+    }
+
+    template<class S>
+    static bool bounded(S*, long) { return false; }
+
+    template<class S, class V>
+    static auto tryPut(S* shard, V&& value, int) -> decltype(shard->TryEnqueue(std::forward<V>(value))) {
+      return shard->TryEnqueue(std::forward<V>(value));
+    }
+
+    template<class S, class V>
+    static bool tryPut(S*, V&&, long) { return false; }
+
+    // Home shard first.  If it is full, every other shard is tried
+    // once before waiting for room in the home shard.
+    template<class V>
+    void put(V&& value) {
+      int h = this->home();
+      if(bounded((Shard*)0, 0)){
+        for(int n=0;n<this->count;n++){
+          ShardSlot& s = this->shards[(h + n) % this->count];
+          if(tryPut(s.Queue, std::forward<V>(value), 0)){
+            s.Size.fetch_add(1, std::memory_order_relaxed);
+            return;
+          }
+        }
+      }
+      ShardSlot& s = this->shards[h];
+      s.Queue->Enqueue(std::forward<V>(value));
+      s.Size.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Tries every shard other than the home shard once
+    bool probe(int start, T* value) {
+      for(int n=1;n<this->count;n++){
+        int i = (start + n) % this->count;
+        if(this->shards[i].Size.load(std::memory_order_relaxed) > 0 && this->take(i, value)) return true;
+      }
+      return false;
+    }
+
+  public:
+    // Every shard is constructed with shardArgs, for example
+    // the capacity of each shard when Shard is a BoundedQueue.
+    template<class... Args>
+    ShardedQueue(int shardCount, ShardPolicy policy, Args&&... shardArgs)
+      : count(shardCount < 1 ? 1 : shardCount), policy(policy) {
+      this->shards = new ShardSlot[this->count];
+      for(int i=0;i<this->count;i++){
+        this->shards[i].Queue = new Shard(shardArgs...);
+        this->shards[i].Size.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    ~ShardedQueue() {
+      for(int i=0;i<this->count;i++)
+        delete this->shards[i].Queue;
+      delete[] this->shards;
+    }
+
+    int ShardCount() const { return this->count; }
+
+    void Enqueue(const T& value) {
+      this->put(value);
+    }
+
+    void Enqueue(T&& value) {
+      this->put(std::move(value));
+    }
+
+    bool Dequeue(T* value) {
+      int h = this->home();
+      if(this->take(h, value)) return true;
+      if(this->count == 1) return false;
+      if(this->policy == ShardTwoChoice){
+        int a = nextRandom() % this->count;
+        int b = nextRandom() % this->count;
+        long sizeA = this->shards[a].Size.load(std::memory_order_relaxed);
+        long sizeB = this->shards[b].Size.load(std::memory_order_relaxed);
+        if(sizeB > sizeA){ a = b; sizeA = sizeB; }
+        if(a != h && sizeA > 0 && this->take(a, value)) return true;
+      }
+      return this->probe(h, value);
+    }
+  };
+}
+
+#endif
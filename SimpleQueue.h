@@ -1,7 +1,10 @@
 #ifndef SIMPLEQUEUE_H
 #define SIMPLEQUEUE_H
 
+#include <new>
+#include <utility>
 #include "IQueue.h"
+#include "Probes.h"
 
 namespace ConcurrentQueues
 {
@@ -11,39 +14,79 @@ namespace ConcurrentQueues
     Node<T>* head;
     Node<T>* tail; 
     
+    template<class... Args>
+    void append(Args&&... args) {
+      Node<T>* node = new Node<T>();
+      new (&node->Value) T(std::forward<Args>(args)...);
+      node->Next.store(0, std::memory_order_relaxed);
+      tail->Next.store(node, std::memory_order_relaxed);
+      tail = node;
+    }
+
   public:
     SimpleQueue() {
       Node<T> *node = new Node<T>();
-      node->Next = 0;
+      node->Next.store(0, std::memory_order_relaxed);
       head = tail = node;
     }		
     
     ~SimpleQueue() {
-      Node<T>* node = head;
-      while(node){
-        Node<T>* next = node->Next;
-        delete node;
-        node = next;
-      }
+      DeleteChain(head);
     }
 
-    void Enqueue(T value) {
-      Node<T>* node = new Node<T>();
-      node->Value = value;
-      node->Next = 0;
-      tail->Next = node;
-      tail = node;
+    template<class... Args>
+    void Emplace(Args&&... args) {
+      QUEUE_PROBE2(enqueue_start, this, 1);
+      this->append(std::forward<Args>(args)...);
+      QUEUE_PROBE2(enqueue_done, this, 1);
+    }
+
+    void Enqueue(const T& value) {
+      this->Emplace(value);
+    }
+
+    void Enqueue(T&& value) {
+      this->Emplace(std::move(value));
+    }
+
+    void EnqueueBulk(const T* values, size_t count) {
+      QUEUE_PROBE2(enqueue_start, this, count);
+      for(size_t i=0;i<count;i++)
+        this->append(values[i]);
+      QUEUE_PROBE2(enqueue_done, this, count);
     }
 
     bool Dequeue(T* value) {
+      QUEUE_PROBE2(dequeue_start, this, 1);
       Node<T>* node = head;
-      Node<T>* next = node->Next;
-      if(!next)	return false;
-      *value = next->Value;
+      Node<T>* next = node->Next.load(std::memory_order_relaxed);
+      if(!next) {
+        QUEUE_PROBE1(dequeue_empty, this);
+        QUEUE_PROBE2(dequeue_done, this, 0);
+        return false;
+      }
+      *value = std::move(next->Value);
+      next->Value.~T();
       head = next;
       delete node;
+      QUEUE_PROBE2(dequeue_done, this, 1);
       return true;
     }
+
+    size_t DequeueBulk(T* values, size_t max) {
+      QUEUE_PROBE2(dequeue_start, this, max);
+      size_t n = 0;
+      while(n < max && head->Next.load(std::memory_order_relaxed)){
+        Node<T>* node = head;
+        head = node->Next.load(std::memory_order_relaxed);
+        values[n++] = std::move(head->Value);
+        head->Value.~T();
+        delete node;
+      }
+      if(n == 0) QUEUE_PROBE1(dequeue_empty, this);
+      QUEUE_PROBE2(dequeue_done, this, n);
+      return n;
+    }
   };
 }
 
@@ -0,0 +1,88 @@
+#ifndef SYNTHETICWORK_H
+#define SYNTHETICWORK_H
+
+#include <stdint.h>
+#include <math.h>
+#include "LatencyHistogram.h"
+
+namespace ConcurrentQueues
+{
+  enum WorkDistribution { WorkFixed, WorkExponential, WorkUniform };
+
+  // How much time a benchmark thread spends between queue
+  // operations: a mean in nanoseconds and how it varies.
+  // Uniform is spread over [0, 2*mean].
+  struct WorkProfile {
+    double MeanNanos;
+    WorkDistribution Distribution;
+    WorkProfile(double meanNanos = 0, WorkDistribution distribution = WorkFixed)
+      : MeanNanos(meanNanos), Distribution(distribution) {}
+  };
+
+  // Busy loop that touches no memory, so it stands in for service
+  // time without loading the allocator or the caches.  Calibrate
+  // once before any thread starts; it measures how many iterations
+  // run per nanosecond on this machine.
+  class SpinWork {
+  private:
+    static double& loopsPerNano() {
+      static double rate = 1.0;
+      return rate;
+    }
+
+  public:
+    static void Spin(uint64_t loops) {
+      for(uint64_t i=0;i<loops;i++)
+        asm volatile("" ::: "memory");
+    }
+
+    // Best of several timed runs, since preemption only ever
+    // makes a run look slower
+    static void Calibrate() {
+      const uint64_t loops = 1000000;
+      uint64_t best = UINT64_MAX;
+      Spin(loops);
+      for(int i=0;i<10;i++){
+        uint64_t begin = MonotonicNanos();
+        Spin(loops);
+        uint64_t took = MonotonicNanos() - begin;
+        if(took < best) best = took;
+      }
+      loopsPerNano() = (double)loops / (best ? best : 1);
+    }
+
+    static double LoopsPerNano() { return loopsPerNano(); }
+  };
+
+  // Draws delays from a WorkProfile and spins for them.  The draws
+  // are made up front into a small table, so Pause allocates
+  // nothing and does no floating point.  One per thread.
+  class WorkDelay {
+  private:
+    static const int TableSize = 1024;
+    uint64_t loops[TableSize];
+    int next;
+
+  public:
+    WorkDelay(const WorkProfile& profile, unsigned seed) : next(0) {
+      uint64_t x = seed * 0x9E3779B97F4A7C15ULL + 1;
+      double scale = profile.MeanNanos * SpinWork::LoopsPerNano();
+      for(int i=0;i<TableSize;i++){
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        double u = (x >> 11) * (1.0 / 9007199254740992.0); // [0, 1)
+        double f = 1.0;
+        if(profile.Distribution == WorkExponential) f = -log(1.0 - u);
+        else if(profile.Distribution == WorkUniform) f = 2.0 * u;
+        this->loops[i] = (uint64_t)(scale * f + 0.5);
+      }
+    }
+
+    void Pause() {
+      uint64_t n = this->loops[this->next];
+      this->next = (this->next + 1) & (TableSize - 1);
+      if(n) SpinWork::Spin(n);
+    }
+  };
+}
+
+#endif
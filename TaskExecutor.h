@@ -0,0 +1,209 @@
+#ifndef TASKEXECUTOR_H
+#define TASKEXECUTOR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "LocklessQueue.h"
+#include "WorkStealingDeque.h"
+#include "EventCount.h"
+
+namespace ConcurrentQueues
+{
+  class TaskExecutor;
+
+  // Counts the tasks submitted with it that haven't finished
+  class TaskGroup {
+  private:
+    long pending;
+    friend class TaskExecutor;
+
+  public:
+    TaskGroup() : pending(0) {}
+  };
+
+  // Unit of work for a TaskExecutor.  The caller owns the task and
+  // must keep it alive until the group it was submitted with is done.
+  class Task {
+  private:
+    TaskGroup* group;
+    friend class TaskExecutor;
+
+  public:
+    Task() : group(0) {}
+    virtual ~Task() {}
+    virtual void Run() = 0;
+  };
+
+  // Fixed size thread pool.  Each worker has a WorkStealingDeque:
+  // tasks submitted from a worker go on its own deque, tasks from
+  // other threads go on a shared LocklessQueue.  A worker runs its
+  // own newest task first, then the shared queue, then steals the
+  // oldest task of another worker.  Workers with nothing to do
+  // spin briefly and then park on an EventCount.
+  //
+  // With workStealing off every task goes through the shared queue,
+  // which makes it a plain pool over a single LocklessQueue.
+  class TaskExecutor {
+  private:
+    struct Worker {
+      WorkStealingDeque<Task*> Deque;
+      TaskExecutor* Owner;
+      pthread_t Thread;
+      unsigned Seed; // Picks the first victim to steal from
+    };
+
+    Worker** workers;
+    int count;
+    bool workStealing;
+    LocklessQueue<Task*> injection; // Tasks submitted from outside
+    EventCount events; // Idle workers wait here for tasks
+    EventCount done; // Outside threads wait here for groups
+    bool stopping;
+
+    // Failed looks for work before a worker parks
+    static const int SpinBeforePark = 64;
+
+    static Worker*& current() {
+      static __thread Worker* worker = 0;
+      return worker;
+    }
+
+    // The calling thread's worker, if it is one of ours
+    Worker* localWorker() {
+      Worker* w = current();
+      return w && w->Owner == this ? w : 0;
+    }
+
+    void run(Task* task) {
+      TaskGroup* group = task->group;
+      task->Run();
+      if(__sync_sub_and_fetch(&group->pending, 1) == 0)
+        this->done.NotifyAfterBarrier(INT_MAX);
+    }
+
+    // Keeps trying a victim while it looks non empty,
+    // since Steal also fails when it loses a race
+    bool steal(Worker* self, Task** task) {
+      unsigned start = self ? (self->Seed = self->Seed * 1103515245 + 12345) >> 8 : 0;
+      for(int i=0;i<this->count;i++){
+        Worker* victim = this->workers[(start + i) % this->count];
+        if(victim == self) continue;
+        while(!victim->Deque.Empty())
+          if(victim->Deque.Steal(task)) return true;
+      }
+      return false;
+    }
+
+    bool findWork(Worker* self, Task** task) {
+      if(self && self->Deque.Pop(task)) return true;
+      if(this->injection.Dequeue(task)) return true;
+      return this->workStealing && this->steal(self, task);
+    }
+
+    void workerLoop(Worker* self) {
+      Task* task;
+      int idle = 0;
+      while(true){
+        if(this->findWork(self, &task)){
+          this->run(task);
+          idle = 0;
+          continue;
+        }
+        if(++idle < SpinBeforePark){
+          CpuRelax();
+          continue;
+        }
+        int key = this->events.PrepareWait();
+        if(this->findWork(self, &task)){
+          this->events.CancelWait();
+          this->run(task);
+          idle = 0;
+          continue;
+        }
+        if(__atomic_load_n(&this->stopping, __ATOMIC_ACQUIRE)){
+          this->events.CancelWait();
+          return;
+        }
+        this->events.Wait(key, 0);
+      }
+    }
+
+    static void* workerMain(void* arg) {
+      Worker* self = static_cast<Worker*>(arg);
+      current() = self;
+      self->Owner->workerLoop(self);
+      return 0;
+    }
+
+  public:
+    TaskExecutor(int threads, bool workStealing = true)
+      : count(threads < 1 ? 1 : threads), workStealing(workStealing), stopping(false) {
+      this->workers = new Worker*[this->count];
+      for(int i=0;i<this->count;i++){
+        this->workers[i] = new Worker();
+        this->workers[i]->Owner = this;
+        this->workers[i]->Seed = i + 1;
+      }
+      for(int i=0;i<this->count;i++){
+        if(pthread_create(&this->workers[i]->Thread, NULL, &TaskExecutor::workerMain, this->workers[i]) != 0){
+          perror("Can't create worker");
+          exit(1);
+        }
+      }
+    }
+
+    // Runs every task already submitted, then stops the workers
+    ~TaskExecutor() {
+      __atomic_store_n(&this->stopping, true, __ATOMIC_RELEASE);
+      this->events.NotifyAll();
+      // Workers that are still running may steal from any deque
+      for(int i=0;i<this->count;i++)
+        pthread_join(this->workers[i]->Thread, NULL);
+      for(int i=0;i<this->count;i++)
+        delete this->workers[i];
+      delete[] this->workers;
+    }
+
+    int WorkerCount() const { return this->count; }
+
+    void Submit(Task* task, TaskGroup* group) {
+      task->group = group;
+      __sync_fetch_and_add(&group->pending, 1);
+      Worker* self = this->localWorker();
+      if(self && this->workStealing)
+        self->Deque.Push(task);
+      else
+        this->injection.Enqueue(task);
+      this->events.Notify();
+    }
+
+    // Returns once every task in group has finished.  Workers run
+    // other tasks while they wait, which is how fork-join tasks
+    // that wait on their children avoid deadlock; other threads
+    // help too, then sleep until a group finishes.
+    void Wait(TaskGroup* group) {
+      Worker* self = this->localWorker();
+      Task* task;
+      while(__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0){
+        if(this->findWork(self, &task)){
+          this->run(task);
+          continue;
+        }
+        if(self){
+          sched_yield();
+          continue;
+        }
+        int key = this->done.PrepareWait();
+        if(__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) == 0){
+          this->done.CancelWait();
+          break;
+        }
+        this->done.Wait(key, 0);
+      }
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef WORKSTEALINGDEQUE_H
+#define WORKSTEALINGDEQUE_H
+
+namespace ConcurrentQueues
+{
+  // Chase-Lev work stealing deque, with the fences of Le et al.
+  // "Correct and Efficient Work-Stealing for Weak Memory Models".
+  // One owner thread pushes and pops at the bottom, any number of
+  // thieves steal from the top.  Only a steal, or a pop racing a
+  // steal for the last item, uses a CAS.
+  //
+  // T must be a pointer or integer type, since items are read by
+  // thieves before they know they won them.  The ring grows when
+  // full; old rings are kept until the deque is destroyed because
+  // a thief may still be reading one.
+  template<class T>
+  class WorkStealingDeque {
+  private:
+    struct Ring {
+      long Mask;
+      T* Items;
+      Ring* Prev; // Smaller ring this one replaced
+      Ring(long size, Ring* prev) : Mask(size-1), Items(new T[size]), Prev(prev) {}
+      ~Ring() { delete[] this->Items; }
+
+      T Get(long i) { return __atomic_load_n(&this->Items[i & this->Mask], __ATOMIC_RELAXED); }
+      void Put(long i, T x) { __atomic_store_n(&this->Items[i & this->Mask], x, __ATOMIC_RELAXED); }
+    };
+
+    char padding0[64];
+    long top; // Next item to steal
+    char padding1[64];
+    long bottom; // Next free slot, owner only writes
+    Ring* ring;
+    char padding2[64];
+
+    // Owner only.  Copies the live items into a ring twice the size.
+    Ring* grow(Ring* old, long b, long t) {
+      Ring* bigger = new Ring(2*(old->Mask+1), old);
+      for(long i=t;i<b;i++)
+        bigger->Put(i, old->Get(i));
+      __atomic_store_n(&this->ring, bigger, __ATOMIC_RELEASE);
+      return bigger;
+    }
+
+  public:
+    // Capacity is rounded up to the next power of two
+    WorkStealingDeque(long capacity = 64) : top(0), bottom(0) {
+      long size = 2;
+      while(size < capacity) size <<= 1;
+      this->ring = new Ring(size, 0);
+    }
+
+    ~WorkStealingDeque() {
+      Ring* r = this->ring;
+      while(r){
+        Ring* prev = r->Prev;
+        delete r;
+        r = prev;
+      }
+    }
+
+    // Owner only
+    void Push(T x) {
+      long b = __atomic_load_n(&this->bottom, __ATOMIC_RELAXED);
+      long t = __atomic_load_n(&this->top, __ATOMIC_ACQUIRE);
+      Ring* r = __atomic_load_n(&this->ring, __ATOMIC_RELAXED);
+      if(b - t > r->Mask) r = this->grow(r, b, t);
+      r->Put(b, x);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      __atomic_store_n(&this->bottom, b+1, __ATOMIC_RELAXED);
+    }
+
+    // Owner only, takes the most recently pushed item
+    bool Pop(T* x) {
+      long b = __atomic_load_n(&this->bottom, __ATOMIC_RELAXED) - 1;
+      Ring* r = __atomic_load_n(&this->ring, __ATOMIC_RELAXED);
+      __atomic_store_n(&this->bottom, b, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      long t = __atomic_load_n(&this->top, __ATOMIC_RELAXED);
+      if(t > b){
+        // Empty
+        __atomic_store_n(&this->bottom, b+1, __ATOMIC_RELAXED);
+        return false;
+      }
+      *x = r->Get(b);
+      if(t == b){
+        // Last item, race the thieves for it
+        bool won = __sync_bool_compare_and_swap(&this->top, t, t+1);
+        __atomic_store_n(&this->bottom, b+1, __ATOMIC_RELAXED);
+        return won;
+      }
+      return true;
+    }
+
+    // Any thread, takes the oldest item.  Returns false if the
+    // deque was empty or another thread got the item first.
+    bool Steal(T* x) {
+      long t = __atomic_load_n(&this->top, __ATOMIC_ACQUIRE);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      long b = __atomic_load_n(&this->bottom, __ATOMIC_ACQUIRE);
+      if(t >= b) return false;
+      Ring* r = __atomic_load_n(&this->ring, __ATOMIC_ACQUIRE);
+      T item = r->Get(t);
+      if(!__sync_bool_compare_and_swap(&this->top, t, t+1)) return false;
+      *x = item;
+      return true;
+    }
+
+    // A snapshot, only exact when nobody else is using the deque
+    bool Empty() {
+      long b = __atomic_load_n(&this->bottom, __ATOMIC_ACQUIRE);
+      long t = __atomic_load_n(&this->top, __ATOMIC_ACQUIRE);
+      return t >= b;
+    }
+  };
+}
+
+#endif
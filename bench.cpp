@@ -1,15 +1,38 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
 #include <tr1/functional>
 #include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/utsname.h>
+#include <string>
+#include <vector>
 #include "IQueue.h"
 #include "SimpleQueue.h"
 #include "LockingQueue.h"
 #include "LocklessQueue.h"
+#include "BoundedQueue.h"
+#include "SegmentedQueue.h"
+#include "SPSCQueue.h"
+#include "MPSCQueue.h"
+#include "ShardedQueue.h"
+#include "TaskExecutor.h"
+#include "FlatCombiningQueue.h"
+#include "LatencyHistogram.h"
+#include "CpuTopology.h"
+#include "SyntheticWork.h"
+#include "PerfCounters.h"
 
 //  Compile with :
-// g++ IQueue.h SimpleQueue.h LockingQueue.h LocklessQueue.h bench.cpp -Wall -lrt -lpthread -o bench
+// g++ -std=c++11 bench.cpp -Wall -lrt -lpthread -o bench
+//
+//  Run ./bench --help for the options.  Without a --scenario it runs
+//  the fixed suite of every section below.
 
 // Used at the end of each to test to print results
 #define RESULT(s) printf("%s\t%s\t%ld\n", s, sum == 0 ? "PASS" : "FAIL", end-begin); 
@@ -18,6 +41,52 @@ using ConcurrentQueues::IQueue;
 using ConcurrentQueues::SimpleQueue;
 using ConcurrentQueues::LockingQueue;
 using ConcurrentQueues::LocklessQueue;
+using ConcurrentQueues::BoundedQueue;
+using ConcurrentQueues::SegmentedQueue;
+using ConcurrentQueues::SPSCQueue;
+using ConcurrentQueues::MPSCQueue;
+using ConcurrentQueues::MPSCHook;
+using ConcurrentQueues::ShardedQueue;
+using ConcurrentQueues::ShardPolicy;
+using ConcurrentQueues::ShardTwoChoice;
+using ConcurrentQueues::ShardRoundRobin;
+using ConcurrentQueues::Task;
+using ConcurrentQueues::TaskGroup;
+using ConcurrentQueues::TaskExecutor;
+using ConcurrentQueues::FlatCombiningQueue;
+using ConcurrentQueues::PthreadMutex;
+using ConcurrentQueues::TTASLock;
+using ConcurrentQueues::TicketLock;
+using ConcurrentQueues::MCSLock;
+using ConcurrentQueues::AdaptiveLock;
+using ConcurrentQueues::CycleClock;
+using ConcurrentQueues::LatencyHistogram;
+using ConcurrentQueues::MonotonicNanos;
+using ConcurrentQueues::CpuRelax;
+using ConcurrentQueues::CpuTopology;
+using ConcurrentQueues::ParseCpuList;
+using ConcurrentQueues::PinAttr;
+using ConcurrentQueues::PinThread;
+using ConcurrentQueues::WorkProfile;
+using ConcurrentQueues::WorkDelay;
+using ConcurrentQueues::SpinWork;
+using ConcurrentQueues::WorkFixed;
+using ConcurrentQueues::WorkExponential;
+using ConcurrentQueues::WorkUniform;
+using ConcurrentQueues::PerfCounters;
+using ConcurrentQueues::Node;
+using ConcurrentQueues::HazardPointers;
+using ConcurrentQueues::EpochReclamation;
+using ConcurrentQueues::MemoryStats;
+
+// Reclamation policies for LocklessQueue<int>
+typedef HazardPointers<Node<int> > HP;
+typedef EpochReclamation<Node<int> > EBR;
+
+// Lock free queues run through the *_lockless tests
+typedef LocklessQueue<int, HP> HPQueue;
+typedef LocklessQueue<int, EBR> EBRQueue;
+typedef SegmentedQueue<int> SegQueue;
 
 // Thread Creation Functions, from MCP Lab Code
 typedef std::tr1::function<void()> ThreadBody;
@@ -28,43 +97,42 @@ static void* threadFunction(void* arg) {
   return 0;
 }
 
-pthread_t makeThread(ThreadBody body) {
+// With cpu >= 0 the thread starts out pinned to that CPU, so
+// whatever it allocates is first touched from there
+pthread_t makeThread(ThreadBody body, int cpu = -1) {
   ThreadBody* copy = new ThreadBody(body);
 
   void* arg = reinterpret_cast<void*>(copy);
   pthread_t thread;
-  if (pthread_create(&thread, NULL, threadFunction, arg) != 0) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (cpu >= 0 && !PinAttr(&attr, cpu)) {
+    fprintf(stderr, "Can't pin thread to cpu %d\n", cpu);
+    exit(1);
+  }
+  if (pthread_create(&thread, &attr, threadFunction, arg) != 0) {
     perror("Can't create thread");
     delete copy;
     exit(1);
   }
+  pthread_attr_destroy(&attr);
   return thread;
 }
 
-// Timer Function
+// Timer Function, in microseconds.  Monotonic so that a clock
+// adjustment during a run can't skew or reverse a measurement.
 typedef uint64_t Ticks;
 Ticks ClockGetTime(){
   timespec ts;
-  clock_gettime(CLOCK_REALTIME, &ts);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
   return (uint64_t)ts.tv_sec * 1000000LL + (uint64_t)ts.tv_nsec / 1000LL;
 }
 
-// Sieve is used to generate some workload between queue operations
-// source : http://www.algolist.net/Algorithms/Number_theoretic/Sieve_of_Eratosthenes
-int sieve(int upperBound) {
-  int count = 0;
-  int upperBoundSquareRoot = (int)sqrt((double)upperBound);
-  bool *isComposite = new bool[upperBound + 1];
-  memset(isComposite, 0, sizeof(bool) * (upperBound + 1));
-  for (int m = 2; m <= upperBoundSquareRoot; m++)
-        if (!isComposite[m])
-              for (int k = m * m; k <= upperBound; k += m)
-                    isComposite[k] = true;
-  for (int m = upperBoundSquareRoot; m <= upperBound; m++)
-        if (!isComposite[m])
-              count++;
-  delete [] isComposite;
-  return count;
+// Each worker draws its delays between operations from
+// its own WorkDelay, seeded differently
+unsigned work_seed(){
+  static unsigned next = 0;
+  return __sync_add_and_fetch(&next, 1);
 }
 
 // Enqueue some data into a queue
@@ -93,17 +161,17 @@ int empty_queue(IQueue<int>* q){
 }
 
 // Performs an Enqueue of Dequeue based on a 
-// set of random numbers.  Will perform a sieve
-// up to sieveBound between each operation.
+// set of random numbers.  Spins for a delay drawn
+// from work before each operation.
 // Fills in sum with the sum of the values enqueued
 // minus the sum of the values dequeued.
-void random_worker(IQueue<int>* q, int iterations, int sieveBound, int* randoms, int offset, long* sum){
+void random_worker(IQueue<int>* q, int iterations, const WorkProfile& work, int* randoms, int offset, long* sum){
+  WorkDelay delay(work, work_seed());
   int x = 0;
   long localSum = 0;
   for(int i=0;i<iterations;i++){
     int r = randoms[offset+i];
-    if(sieveBound > 0)
-      sieve(sieveBound);
+    delay.Pause();
     if(r % 2 == 0){
       x = r % 37;
       q->Enqueue(x);
@@ -118,93 +186,132 @@ void random_worker(IQueue<int>* q, int iterations, int sieveBound, int* randoms,
 
 // Performs a series of Enqueues then Dequeues.
 // Similar to random_worker in all other regards.
-void series_worker(IQueue<int>* q, int iterations, int sieveBound, int enqueueCount, int dequeueCount, long* sum){
+// Each step moves batch values, through EnqueueBulk and
+// DequeueBulk when batch is more than one.
+void series_worker(IQueue<int>* q, int iterations, const WorkProfile& work, int enqueueCount, int dequeueCount, int batch, long* sum){
+  WorkDelay delay(work, work_seed());
   int x = 0;
+  int values[batch];
   long localSum = 0;
   for(int i=0;i<iterations;i++){
     for(int j=0;j<enqueueCount;j++){
-      if(sieveBound > 0)
-        sieve(sieveBound);  
+      delay.Pause();
       x = i % 37;
-      q->Enqueue(x);
-      localSum += x;
+      if(batch == 1){
+        q->Enqueue(x);
+      }else{
+        for(int k=0;k<batch;k++)
+          values[k] = x;
+        q->EnqueueBulk(values, batch);
+      }
+      localSum += x * batch;
     }
     for(int j=0;j<dequeueCount;j++){
-      if(sieveBound > 0)
-        sieve(sieveBound);      
-      if(q->Dequeue(&x))
-        localSum -= x;      
+      delay.Pause();
+      if(batch == 1){
+        if(q->Dequeue(&x))
+          localSum -= x;      
+      }else{
+        size_t n = q->DequeueBulk(values, batch);
+        for(size_t k=0;k<n;k++)
+          localSum -= values[k];
+      }
     }
   }
   *sum += localSum;
 }
 
-void series_sequential_simple(int iterations, int sieveBound, int enqueueCount, int dequeueCount){
+void series_sequential_simple(int iterations, const WorkProfile& work, int enqueueCount, int dequeueCount, int batch){
   long sum = 0;
   SimpleQueue<int> simple;
   if(dequeueCount > enqueueCount)
-    sum += seed_queue(&simple, iterations / (dequeueCount - enqueueCount)); 
+    sum += seed_queue(&simple, batch * iterations / (dequeueCount - enqueueCount)); 
   Ticks begin = ClockGetTime();
-  series_worker(&simple, iterations, sieveBound, enqueueCount, dequeueCount, &sum);
+  series_worker(&simple, iterations, work, enqueueCount, dequeueCount, batch, &sum);
   Ticks end = ClockGetTime();    
   sum -= empty_queue(&simple);  
   RESULT("Sequential Simple  ");
 }
 
-void series_sequential_locking(int iterations, int sieveBound, int enqueueCount, int dequeueCount){
+void series_sequential_locking(int iterations, const WorkProfile& work, int enqueueCount, int dequeueCount, int batch){
   long sum = 0;
   LockingQueue<int> locking;
   if(dequeueCount > enqueueCount)
-    sum += seed_queue(&locking, iterations / (dequeueCount - enqueueCount));  
+    sum += seed_queue(&locking, batch * iterations / (dequeueCount - enqueueCount));  
   Ticks begin = ClockGetTime();
-  series_worker(&locking, iterations, sieveBound, enqueueCount, dequeueCount, &sum);
+  series_worker(&locking, iterations, work, enqueueCount, dequeueCount, batch, &sum);
   Ticks end = ClockGetTime();  
   sum -= empty_queue(&locking);
   RESULT("Sequential Locking ");
 }
 
-void series_sequential_lockless(int iterations, int sieveBound, int enqueueCount, int dequeueCount){
+template<class Q>
+void series_sequential_lockless(int iterations, const WorkProfile& work, int enqueueCount, int dequeueCount, int batch, const char* name){
   long sum = 0;
-  LocklessQueue<int> lockless;
+  Q lockless;
   IQueue<int>* a = lockless.CreateAccessor();  
   if(dequeueCount > enqueueCount)
-    sum += seed_queue(a, iterations / (dequeueCount - enqueueCount));  
+    sum += seed_queue(a, batch * iterations / (dequeueCount - enqueueCount));  
   Ticks begin = ClockGetTime();
-  series_worker(a, iterations, sieveBound, enqueueCount, dequeueCount, &sum);
+  series_worker(a, iterations, work, enqueueCount, dequeueCount, batch, &sum);
   Ticks end = ClockGetTime();    
   sum -= empty_queue(a);
   delete a;  
-  RESULT("Sequential Lockless");
+  RESULT(name);
+}
+
+// The bounded queue has to be large enough to hold everything
+// a series run can leave behind, or Enqueue will wait forever.
+size_t series_capacity(int iterations, int enqueueCount, int dequeueCount, int batch){
+  size_t capacity = (size_t)iterations * enqueueCount * batch;
+  if(dequeueCount > enqueueCount)
+    capacity += batch * iterations / (dequeueCount - enqueueCount);
+  return capacity;
 }
 
-void series_concurrent_locking(int iterations, int sieveBound, int enqueueCount, int dequeueCount, int num_threads){
+void series_sequential_bounded(int iterations, const WorkProfile& work, int enqueueCount, int dequeueCount, int batch){
   long sum = 0;
-  LockingQueue<int> locking;
+  BoundedQueue<int> bounded(series_capacity(iterations, enqueueCount, dequeueCount, batch));
   if(dequeueCount > enqueueCount)
-    sum += seed_queue(&locking, iterations / (dequeueCount - enqueueCount));   
+    sum += seed_queue(&bounded, batch * iterations / (dequeueCount - enqueueCount));
+  Ticks begin = ClockGetTime();
+  series_worker(&bounded, iterations, work, enqueueCount, dequeueCount, batch, &sum);
+  Ticks end = ClockGetTime();
+  sum -= empty_queue(&bounded);
+  RESULT("Sequential Bounded ");
+}
+
+// Queues every thread uses directly, without an accessor
+template<class Q>
+void series_concurrent_shared(int iterations, const WorkProfile& work, int enqueueCount, int dequeueCount, int batch, int num_threads, const char* name){
+  long sum = 0;
+  Q q;
+  if(dequeueCount > enqueueCount)
+    sum += seed_queue(&q, batch * iterations / (dequeueCount - enqueueCount));   
   long sums[num_threads];
   pthread_t threads[num_threads];
   int n = iterations / num_threads;
   Ticks begin = ClockGetTime();  
   for(int i=0;i<num_threads;i++){
     sums[i] = 0;
-    threads[i] = makeThread(std::tr1::bind(&series_worker, &locking, n, sieveBound, enqueueCount, dequeueCount, &sums[i]));
+    threads[i] = makeThread(std::tr1::bind(&series_worker, &q, n, work, enqueueCount, dequeueCount, batch, &sums[i]));
   }
 	for(int i=0;i<num_threads;i++)
 		pthread_join(threads[i],NULL);    
   Ticks end = ClockGetTime();
  	for(int i=0;i<num_threads;i++)
     sum += sums[i];
-  sum -= empty_queue(&locking);
-  RESULT("Concurrent Locking ");
+  sum -= empty_queue(&q);
+  RESULT(name);
 }
 
-void series_concurrent_lockless(int iterations, int sieveBound, int enqueueCount, int dequeueCount, int num_threads){
+template<class Q>
+void series_concurrent_lockless(int iterations, const WorkProfile& work, int enqueueCount, int dequeueCount, int batch, int num_threads, const char* name){
   long sum = 0;  
-  LocklessQueue<int> lockless;
+  Q lockless;
   IQueue<int>* a = lockless.CreateAccessor();  
   if(dequeueCount > enqueueCount)
-    sum += seed_queue(a, iterations / (dequeueCount - enqueueCount));   
+    sum += seed_queue(a, batch * iterations / (dequeueCount - enqueueCount));   
   long sums[num_threads];
   IQueue<int>* queues[num_threads];
   pthread_t threads[num_threads];
@@ -213,7 +320,7 @@ void series_concurrent_lockless(int iterations, int sieveBound, int enqueueCount
   for(int i=0;i<num_threads;i++){
     sums[i] = 0;  
     queues[i] = lockless.CreateAccessor();
-    threads[i] = makeThread(std::tr1::bind(&series_worker, queues[i], n, sieveBound, enqueueCount, dequeueCount, &sums[i]));
+    threads[i] = makeThread(std::tr1::bind(&series_worker, queues[i], n, work, enqueueCount, dequeueCount, batch, &sums[i]));
   }  
 	for(int i=0;i<num_threads;i++){
 		pthread_join(threads[i],NULL);    
@@ -224,50 +331,109 @@ void series_concurrent_lockless(int iterations, int sieveBound, int enqueueCount
     sum += sums[i];
   sum -= empty_queue(a);
   delete a;
-  RESULT("Concurrent Lockless");  
+  RESULT(name);  
+}
+
+// One shard per thread
+template<class Shard>
+void series_concurrent_sharded(int iterations, const WorkProfile& work, int enqueueCount, int dequeueCount, int batch, int num_threads, ShardPolicy policy, const char* name){
+  long sum = 0;
+  ShardedQueue<int, Shard> sharded(num_threads, policy);
+  if(dequeueCount > enqueueCount)
+    sum += seed_queue(&sharded, batch * iterations / (dequeueCount - enqueueCount));   
+  long sums[num_threads];
+  pthread_t threads[num_threads];
+  int n = iterations / num_threads;
+  Ticks begin = ClockGetTime();  
+  for(int i=0;i<num_threads;i++){
+    sums[i] = 0;
+    threads[i] = makeThread(std::tr1::bind(&series_worker, &sharded, n, work, enqueueCount, dequeueCount, batch, &sums[i]));
+  }
+	for(int i=0;i<num_threads;i++)
+		pthread_join(threads[i],NULL);    
+  Ticks end = ClockGetTime();
+ 	for(int i=0;i<num_threads;i++)
+    sum += sums[i];
+  sum -= empty_queue(&sharded);
+  RESULT(name);
+}
+
+void series_concurrent_bounded(int iterations, const WorkProfile& work, int enqueueCount, int dequeueCount, int batch, int num_threads){
+  long sum = 0;
+  BoundedQueue<int> bounded(series_capacity(iterations, enqueueCount, dequeueCount, batch));
+  if(dequeueCount > enqueueCount)
+    sum += seed_queue(&bounded, batch * iterations / (dequeueCount - enqueueCount));
+  long sums[num_threads];
+  pthread_t threads[num_threads];
+  int n = iterations / num_threads;
+  Ticks begin = ClockGetTime();
+  for(int i=0;i<num_threads;i++){
+    sums[i] = 0;
+    threads[i] = makeThread(std::tr1::bind(&series_worker, &bounded, n, work, enqueueCount, dequeueCount, batch, &sums[i]));
+  }
+  for(int i=0;i<num_threads;i++)
+    pthread_join(threads[i],NULL);
+  Ticks end = ClockGetTime();
+  for(int i=0;i<num_threads;i++)
+    sum += sums[i];
+  sum -= empty_queue(&bounded);
+  RESULT("Concurrent Bounded ");
 }
 
-void random_sequential_simple(int iterations, int sieveBound, int* randoms){
+void random_sequential_simple(int iterations, const WorkProfile& work, int* randoms){
   SimpleQueue<int> simple;
   long sum = 0;
   Ticks begin = ClockGetTime();
-  random_worker(&simple, iterations, sieveBound, randoms, 0, &sum);
+  random_worker(&simple, iterations, work, randoms, 0, &sum);
   Ticks end = ClockGetTime();
   sum -= empty_queue(&simple);
   RESULT("Sequential Simple  ");
 }
 
-void random_sequential_locking(int iterations, int sieveBound, int* randoms){
+void random_sequential_locking(int iterations, const WorkProfile& work, int* randoms){
   LockingQueue<int> locking; 
   long sum = 0;
   Ticks begin = ClockGetTime();
-  random_worker(&locking, iterations, sieveBound, randoms, 0, &sum);
+  random_worker(&locking, iterations, work, randoms, 0, &sum);
   Ticks end = ClockGetTime();  
   sum -= empty_queue(&locking);
   RESULT("Sequential Locking ");
 }
 
-void random_sequential_lockless(int iterations, int sieveBound, int* randoms){
-  LocklessQueue<int> lockless;
+template<class Q>
+void random_sequential_lockless(int iterations, const WorkProfile& work, int* randoms, const char* name){
+  Q lockless;
   long sum = 0;
   IQueue<int>* a = lockless.CreateAccessor();
   Ticks begin = ClockGetTime();
-  random_worker(a, iterations, sieveBound, randoms, 0, &sum);
+  random_worker(a, iterations, work, randoms, 0, &sum);
   Ticks end = ClockGetTime();  
   sum -= empty_queue(a);
   delete a;
-  RESULT("Sequential Lockless");
+  RESULT(name);
 }
 
-void random_concurrent_locking(int iterations, int sieveBound, int* randoms, int num_threads){
-  LockingQueue<int> locking;
+void random_sequential_bounded(int iterations, const WorkProfile& work, int* randoms){
+  BoundedQueue<int> bounded(iterations);
+  long sum = 0;
+  Ticks begin = ClockGetTime();
+  random_worker(&bounded, iterations, work, randoms, 0, &sum);
+  Ticks end = ClockGetTime();
+  sum -= empty_queue(&bounded);
+  RESULT("Sequential Bounded ");
+}
+
+// Queues every thread uses directly, without an accessor
+template<class Q>
+void random_concurrent_shared(int iterations, const WorkProfile& work, int* randoms, int num_threads, const char* name){
+  Q q;
   pthread_t threads[num_threads];
   long sums[num_threads];
   int n = iterations / num_threads;
   Ticks begin = ClockGetTime();  
   for(int i=0;i<num_threads;i++){
     sums[i] = 0;  
-    threads[i] = makeThread(std::tr1::bind(&random_worker, &locking, n, sieveBound, randoms, n*i, &sums[i]));
+    threads[i] = makeThread(std::tr1::bind(&random_worker, &q, n, work, randoms, n*i, &sums[i]));
   }
 	for(int i=0;i<num_threads;i++)
 		pthread_join(threads[i],NULL);    
@@ -275,12 +441,13 @@ void random_concurrent_locking(int iterations, int sieveBound, int* randoms, int
   long sum = 0;
 	for(int i=0;i<num_threads;i++)
     sum += sums[i];
-  sum -= empty_queue(&locking);
-  RESULT("Concurrent Locking ");    
+  sum -= empty_queue(&q);
+  RESULT(name);    
 }
 
-void random_concurrent_lockless(int iterations, int sieveBound, int* randoms, int num_threads){
-  LocklessQueue<int> lockless;
+template<class Q>
+void random_concurrent_lockless(int iterations, const WorkProfile& work, int* randoms, int num_threads, const char* name){
+  Q lockless;
   IQueue<int>* queues[num_threads];
   pthread_t threads[num_threads];
   long sums[num_threads];
@@ -289,7 +456,7 @@ void random_concurrent_lockless(int iterations, int sieveBound, int* randoms, in
   for(int i=0;i<num_threads;i++){
     sums[i] = 0;  
     queues[i] = lockless.CreateAccessor();
-    threads[i] = makeThread(std::tr1::bind(&random_worker, queues[i], n, sieveBound, randoms, n*i, &sums[i]));
+    threads[i] = makeThread(std::tr1::bind(&random_worker, queues[i], n, work, randoms, n*i, &sums[i]));
   }  
 	for(int i=0;i<num_threads;i++){
 		pthread_join(threads[i],NULL);    
@@ -302,10 +469,52 @@ void random_concurrent_lockless(int iterations, int sieveBound, int* randoms, in
   IQueue<int>* a = lockless.CreateAccessor();
   sum -= empty_queue(a);
   delete a;    
-  RESULT("Concurrent Lockless");
+  RESULT(name);
 }
 
-void random_tests(int iterations, int sieveBound, int threads){ 
+// One shard per thread
+template<class Shard>
+void random_concurrent_sharded(int iterations, const WorkProfile& work, int* randoms, int num_threads, ShardPolicy policy, const char* name){
+  ShardedQueue<int, Shard> sharded(num_threads, policy);
+  pthread_t threads[num_threads];
+  long sums[num_threads];
+  int n = iterations / num_threads;
+  Ticks begin = ClockGetTime();  
+  for(int i=0;i<num_threads;i++){
+    sums[i] = 0;  
+    threads[i] = makeThread(std::tr1::bind(&random_worker, &sharded, n, work, randoms, n*i, &sums[i]));
+  }
+	for(int i=0;i<num_threads;i++)
+		pthread_join(threads[i],NULL);    
+  Ticks end = ClockGetTime();  
+  long sum = 0;
+	for(int i=0;i<num_threads;i++)
+    sum += sums[i];
+  sum -= empty_queue(&sharded);
+  RESULT(name);    
+}
+
+void random_concurrent_bounded(int iterations, const WorkProfile& work, int* randoms, int num_threads){
+  BoundedQueue<int> bounded(iterations);
+  pthread_t threads[num_threads];
+  long sums[num_threads];
+  int n = iterations / num_threads;
+  Ticks begin = ClockGetTime();
+  for(int i=0;i<num_threads;i++){
+    sums[i] = 0;
+    threads[i] = makeThread(std::tr1::bind(&random_worker, &bounded, n, work, randoms, n*i, &sums[i]));
+  }
+  for(int i=0;i<num_threads;i++)
+    pthread_join(threads[i],NULL);
+  Ticks end = ClockGetTime();
+  long sum = 0;
+  for(int i=0;i<num_threads;i++)
+    sum += sums[i];
+  sum -= empty_queue(&bounded);
+  RESULT("Concurrent Bounded ");
+}
+
+void random_tests(int iterations, const WorkProfile& work, int threads){ 
   printf("\nRandom Tests\n");
   
   // Generate randoms to determine queue ops
@@ -314,60 +523,1518 @@ void random_tests(int iterations, int sieveBound, int threads){
   for(int i=0;i<iterations;i++)
     randoms[i] = rand();
   
-  random_sequential_simple(iterations, sieveBound, randoms);
-  random_sequential_locking(iterations, sieveBound, randoms);
-  random_sequential_lockless(iterations, sieveBound, randoms);
-  random_concurrent_locking(iterations, sieveBound, randoms, threads);
-  random_concurrent_lockless(iterations, sieveBound, randoms, threads);
+  random_sequential_simple(iterations, work, randoms);
+  random_sequential_locking(iterations, work, randoms);
+  random_sequential_lockless<HPQueue>(iterations, work, randoms, "Sequential Lockless");
+  random_sequential_lockless<EBRQueue>(iterations, work, randoms, "Sequential EBR     ");
+  random_sequential_lockless<SegQueue>(iterations, work, randoms, "Sequential Segments");
+  random_sequential_bounded(iterations, work, randoms);
+  random_concurrent_shared<LockingQueue<int> >(iterations, work, randoms, threads, "Concurrent Locking ");
+  random_concurrent_shared<FlatCombiningQueue<int> >(iterations, work, randoms, threads, "Concurrent Combining");
+  random_concurrent_lockless<HPQueue>(iterations, work, randoms, threads, "Concurrent Lockless");
+  random_concurrent_lockless<EBRQueue>(iterations, work, randoms, threads, "Concurrent EBR     ");
+  random_concurrent_lockless<SegQueue>(iterations, work, randoms, threads, "Concurrent Segments");
+  random_concurrent_bounded(iterations, work, randoms, threads);
+  random_concurrent_sharded<LocklessQueue<int> >(iterations, work, randoms, threads, ShardTwoChoice, "Sharded Lockless 2C");
+  random_concurrent_sharded<LocklessQueue<int> >(iterations, work, randoms, threads, ShardRoundRobin, "Sharded Lockless RR");
+  random_concurrent_sharded<LockingQueue<int> >(iterations, work, randoms, threads, ShardTwoChoice, "Sharded Locking 2C ");
   
   delete[] randoms;
 }
 
 
-void series_tests(int iterations, int sieveBound, int threads, int bias){
-  // Adjust iterations for the bias as to not carry out too many operations.
-  iterations /= bias+1;
+void series_tests(int iterations, const WorkProfile& work, int threads, int bias, int batch){
+  // Adjust iterations for the bias and batch size as to not carry out too many operations.
+  iterations /= (bias+1) * batch;
   printf("\nEnqueue Bias Series Tests\n");
-  series_sequential_simple(iterations, sieveBound, bias, 1);
-  series_sequential_locking(iterations, sieveBound, bias, 1);
-  series_sequential_lockless(iterations, sieveBound, bias, 1);    
-  series_concurrent_locking(iterations, sieveBound, bias, 1, threads);
-  series_concurrent_lockless(iterations, sieveBound, bias, 1, threads);
+  series_sequential_simple(iterations, work, bias, 1, batch);
+  series_sequential_locking(iterations, work, bias, 1, batch);
+  series_sequential_lockless<HPQueue>(iterations, work, bias, 1, batch, "Sequential Lockless");
+  series_sequential_lockless<EBRQueue>(iterations, work, bias, 1, batch, "Sequential EBR     ");
+  series_sequential_lockless<SegQueue>(iterations, work, bias, 1, batch, "Sequential Segments");
+  series_sequential_bounded(iterations, work, bias, 1, batch);
+  series_concurrent_shared<LockingQueue<int> >(iterations, work, bias, 1, batch, threads, "Concurrent Locking ");
+  series_concurrent_shared<FlatCombiningQueue<int> >(iterations, work, bias, 1, batch, threads, "Concurrent Combining");
+  series_concurrent_lockless<HPQueue>(iterations, work, bias, 1, batch, threads, "Concurrent Lockless");
+  series_concurrent_lockless<EBRQueue>(iterations, work, bias, 1, batch, threads, "Concurrent EBR     ");
+  series_concurrent_lockless<SegQueue>(iterations, work, bias, 1, batch, threads, "Concurrent Segments");
+  series_concurrent_bounded(iterations, work, bias, 1, batch, threads);
+  series_concurrent_sharded<LocklessQueue<int> >(iterations, work, bias, 1, batch, threads, ShardTwoChoice, "Sharded Lockless 2C");
+  series_concurrent_sharded<LocklessQueue<int> >(iterations, work, bias, 1, batch, threads, ShardRoundRobin, "Sharded Lockless RR");
+  series_concurrent_sharded<LockingQueue<int> >(iterations, work, bias, 1, batch, threads, ShardTwoChoice, "Sharded Locking 2C ");
   printf("\nDequeue Bias Series Tests\n");  
-  series_sequential_simple(iterations, sieveBound, 1, bias);  
-  series_sequential_locking(iterations, sieveBound, 1, bias);
-  series_sequential_lockless(iterations, sieveBound, 1, bias);  
-  series_concurrent_locking(iterations, sieveBound, 1, bias, threads);
-  series_concurrent_lockless(iterations, sieveBound, 1, bias, threads);  
+  series_sequential_simple(iterations, work, 1, bias, batch);  
+  series_sequential_locking(iterations, work, 1, bias, batch);
+  series_sequential_lockless<HPQueue>(iterations, work, 1, bias, batch, "Sequential Lockless");
+  series_sequential_lockless<EBRQueue>(iterations, work, 1, bias, batch, "Sequential EBR     ");
+  series_sequential_lockless<SegQueue>(iterations, work, 1, bias, batch, "Sequential Segments");
+  series_sequential_bounded(iterations, work, 1, bias, batch);
+  series_concurrent_shared<LockingQueue<int> >(iterations, work, 1, bias, batch, threads, "Concurrent Locking ");
+  series_concurrent_shared<FlatCombiningQueue<int> >(iterations, work, 1, bias, batch, threads, "Concurrent Combining");
+  series_concurrent_lockless<HPQueue>(iterations, work, 1, bias, batch, threads, "Concurrent Lockless");
+  series_concurrent_lockless<EBRQueue>(iterations, work, 1, bias, batch, threads, "Concurrent EBR     ");
+  series_concurrent_lockless<SegQueue>(iterations, work, 1, bias, batch, threads, "Concurrent Segments");
+  series_concurrent_bounded(iterations, work, 1, bias, batch, threads);
+  series_concurrent_sharded<LocklessQueue<int> >(iterations, work, 1, bias, batch, threads, ShardTwoChoice, "Sharded Lockless 2C");
+  series_concurrent_sharded<LocklessQueue<int> >(iterations, work, 1, bias, batch, threads, ShardRoundRobin, "Sharded Lockless RR");
+  series_concurrent_sharded<LockingQueue<int> >(iterations, work, 1, bias, batch, threads, ShardTwoChoice, "Sharded Locking 2C ");
 }
 
-int main( int argc, const char* argv[] )
-{
-  int iterations = -1;
-  int sieveBound = -1;  
-  int threads = -1;
-  int bias = -1;
+// Measures the cost of hazard pointer scans as the number of
+// records grows.  One accessor is created per simulated thread and
+// each performs an Enqueue/Dequeue so its hazard pointers are left
+// set.  A single accessor then runs Enqueue/Dequeue pairs; it scans
+// every R() = H*K dequeues, so the time per operation shows how
+// the scan cost grows with the number of threads.
+void scan_tests(int iterations){
+  printf("\nHazard Pointer Scan Tests\n");
+  for(int num_threads=1;num_threads<=128;num_threads*=2){
+    LocklessQueue<int> lockless;
+    IQueue<int>* queues[num_threads];
+    int x;
+    for(int i=0;i<num_threads;i++){
+      queues[i] = lockless.CreateAccessor();
+      queues[i]->Enqueue(i);
+      queues[i]->Dequeue(&x);
+    }
+    IQueue<int>* a = queues[0];
+    Ticks begin = ClockGetTime();
+    for(int i=0;i<iterations;i++){
+      a->Enqueue(i);
+      a->Dequeue(&x);
+    }
+    Ticks end = ClockGetTime();
+    // Each iteration is two operations
+    printf("Threads %3d\t%.1f ns/op\n", num_threads, (end-begin) * 1000.0 / (2.0 * iterations));
+    for(int i=0;i<num_threads;i++)
+      delete queues[i];
+  }
+}
 
-	if (argc == 5){
-    iterations = atoi(argv[1]);
-    sieveBound = atoi(argv[2]);    
-    threads = atoi(argv[3]);
-    bias = atoi(argv[4]);
+// Until the workers are done, dequeues and then holds its hazard
+// pointers, or with pin its epoch, for 20ms at a time, like a
+// reader that keeps being descheduled in the middle of an operation.
+template<class Q>
+void stall_reader(Q* q, IQueue<int>* a, bool pin, int* ready, int* running){
+  int x;
+  while(__atomic_load_n(running, __ATOMIC_ACQUIRE) > 0){
+    if(pin) q->BeginBatch(a);
+    a->Dequeue(&x);
+    a->Enqueue(x);
+    if(__atomic_load_n(ready, __ATOMIC_RELAXED) == 0) __atomic_store_n(ready, 1, __ATOMIC_RELEASE);
+    usleep(20000);
+    if(pin) q->EndBatch(a);
   }
-  
-  if(iterations <= 0) iterations = 1000000;
-  if(threads <= 0) threads = 8;
-  if(sieveBound < 0) sieveBound = 100;
-  if(bias <= 0) bias = 2;
- 
-  printf("\nIterations %d\n", iterations);
-  printf("Sieve Bound %d\n", sieveBound);  
+}
+
+void stall_worker(IQueue<int>* a, int iterations, int* ready, int* running){
+  int x;
+  while(__atomic_load_n(ready, __ATOMIC_ACQUIRE) == 0)
+    sched_yield();
+  for(int i=0;i<iterations;i++){
+    a->Enqueue(i);
+    a->Dequeue(&x);
+  }
+  __sync_fetch_and_sub(running, 1);
+}
+
+// Worst case memory with a stalled reader.  The workers run
+// Enqueue/Dequeue pairs while the main thread samples
+// GetMemoryStats every millisecond for the peak number of
+// retired nodes.  Allocated nodes are never given back, so
+// the final count is the high-water mark of the node memory.
+template<class Q>
+void stall_run(int iterations, int num_threads, unsigned long limit, bool pin, const char* name){
+  Q q;
+  q.SetUnreclaimedLimit(limit);
+  q.Enqueue(0);
+  int ready = 0;
+  int running = num_threads;
+  IQueue<int>* stalled = q.CreateAccessor();
+  IQueue<int>* accessors[num_threads];
+  pthread_t threads[num_threads + 1];
+  threads[num_threads] = makeThread(std::tr1::bind(&stall_reader<Q>, &q, stalled, pin, &ready, &running));
+  for(int i=0;i<num_threads;i++){
+    accessors[i] = q.CreateAccessor();
+    threads[i] = makeThread(std::tr1::bind(&stall_worker, accessors[i], iterations / num_threads, &ready, &running));
+  }
+
+  unsigned long peakRetired = 0;
+  MemoryStats stats;
+  Ticks begin = ClockGetTime();
+  while(__atomic_load_n(&running, __ATOMIC_ACQUIRE) > 0){
+    q.GetMemoryStats(&stats);
+    if(stats.RetiredNodes > peakRetired) peakRetired = stats.RetiredNodes;
+    usleep(1000);
+  }
+  Ticks end = ClockGetTime();
+  for(int i=0;i<=num_threads;i++)
+    pthread_join(threads[i], NULL);
+  q.GetMemoryStats(&stats);
+  if(stats.RetiredNodes > peakRetired) peakRetired = stats.RetiredNodes;
+
+  char label[64];
+  if(limit) snprintf(label, sizeof(label), "%lu", limit);
+  else snprintf(label, sizeof(label), "none");
+  printf("%s\t%s\t%lu\t%.1f KB\t%.1f KB\t%lu\t%ld\n", name, label, peakRetired,
+         stats.NodeBytes / 1024.0, stats.RecordBytes / 1024.0, stats.Throttles, end-begin);
+  for(int i=0;i<num_threads;i++)
+    delete accessors[i];
+  delete stalled;
+}
+
+void stall_tests(int iterations, int threads){
+  printf("\nStalled Reader Memory Tests\n");
+  printf("Queue\tLimit\tPeak retired\tNode memory\tRecord memory\tThrottles\tTime\n");
+  stall_run<HPQueue>(iterations, threads, 0, false, "Lockless Hazard Pointers");
+  stall_run<HPQueue>(iterations, threads, 1024, false, "Lockless Hazard Pointers");
+  stall_run<EBRQueue>(iterations, threads, 0, true, "Lockless Epochs");
+  stall_run<EBRQueue>(iterations, threads, 1024, true, "Lockless Epochs");
+}
+
+// Blocks in WaitDequeue and records how long each value took
+// to arrive after the producer stamped it.
+template<class Q>
+void wakeup_consumer(Q* q, int rounds, Ticks* total, Ticks* worst){
+  Ticks stamp;
+  for(int i=0;i<rounds;i++){
+    q->WaitDequeue(&stamp);
+    Ticks latency = ClockGetTime() - stamp;
+    *total += latency;
+    if(latency > *worst) *worst = latency;
+  }
+}
+
+// Enqueues a timestamp every millisecond, long enough
+// for the consumer to have given up spinning and parked.
+template<class Q>
+void wakeup_latency(int rounds, const char* name){
+  Q q;
+  Ticks total = 0, worst = 0;
+  pthread_t consumer = makeThread(std::tr1::bind(&wakeup_consumer<Q>, &q, rounds, &total, &worst));
+  for(int i=0;i<rounds;i++){
+    usleep(1000);
+    q.Enqueue(ClockGetTime());
+  }
+  pthread_join(consumer, NULL);
+  printf("%s\tavg %.1f us\tmax %ld us\n", name, (double)total / rounds, (long)worst);
+}
+
+void wakeup_tests(int rounds){
+  printf("\nBlocking Dequeue Wakeup Latency\n");
+  wakeup_latency<LockingQueue<Ticks> >(rounds, "Wakeup Locking     ");
+  wakeup_latency<LocklessQueue<Ticks> >(rounds, "Wakeup Lockless    ");
+}
+
+// One producer thread, one consumer thread.  Each end of a queue
+// is passed separately so the lock free queues can use an accessor
+// per thread; the other queues pass the same pointer twice.
+void spsc_producer(IQueue<int>* q, int iterations, long* sum){
+  int x;
+  for(int i=0;i<iterations;i++){
+    x = i % 37;
+    q->Enqueue(x);
+    *sum += x;
+  }
+}
+
+void spsc_consumer(IQueue<int>* q, int iterations, long* sum){
+  int x;
+  for(int i=0;i<iterations;i++){
+    while(!q->Dequeue(&x))
+      sched_yield();
+    *sum -= x;
+  }
+}
+
+// Sends each value back on the other queue
+void spsc_echo(IQueue<int>* in, IQueue<int>* out, int rounds){
+  int x;
+  for(int i=0;i<rounds;i++){
+    while(!in->Dequeue(&x))
+      sched_yield();
+    out->Enqueue(x);
+  }
+}
+
+// Streams iterations values from the producer end to the consumer
+// end, then bounces rounds single values off an echo thread to
+// measure the latency of a hand off.
+void spsc_pair(IQueue<int>* ping, IQueue<int>* pingEnd, IQueue<int>* pong, IQueue<int>* pongEnd,
+               int iterations, int rounds, const char* name){
+  long sum = 0, consumed = 0;
+  Ticks begin = ClockGetTime();
+  pthread_t consumer = makeThread(std::tr1::bind(&spsc_consumer, pingEnd, iterations, &consumed));
+  spsc_producer(ping, iterations, &sum);
+  pthread_join(consumer, NULL);
+  Ticks end = ClockGetTime();
+  sum += consumed;
+
+  int x;
+  pthread_t echo = makeThread(std::tr1::bind(&spsc_echo, pingEnd, pongEnd, rounds));
+  Ticks trip = ClockGetTime();
+  for(int i=0;i<rounds;i++){
+    ping->Enqueue(i);
+    while(!pong->Dequeue(&x))
+      sched_yield();
+    if(x != i) sum++;
+  }
+  trip = ClockGetTime() - trip;
+  pthread_join(echo, NULL);
+  printf("%s\t%s\t%ld\t%.0f ns/round trip\n", name, sum == 0 ? "PASS" : "FAIL", (long)(end-begin),
+         trip * 1000.0 / rounds);
+}
+
+void spsc_tests(int iterations){
+  int rounds = iterations / 10;
+  printf("\nSingle Producer Single Consumer Tests\n");
+  {
+    SPSCQueue<int> ping(1024), pong(1024);
+    spsc_pair(&ping, &ping, &pong, &pong, iterations, rounds, "SPSC               ");
+  }
+  {
+    BoundedQueue<int> ping(1024), pong(1024);
+    spsc_pair(&ping, &ping, &pong, &pong, iterations, rounds, "Bounded            ");
+  }
+  {
+    LockingQueue<int> ping, pong;
+    spsc_pair(&ping, &ping, &pong, &pong, iterations, rounds, "Locking            ");
+  }
+  {
+    LocklessQueue<int> ping, pong;
+    IQueue<int>* ends[4] = { ping.CreateAccessor(), ping.CreateAccessor(),
+                             pong.CreateAccessor(), pong.CreateAccessor() };
+    spsc_pair(ends[0], ends[1], ends[2], ends[3], iterations, rounds, "Lockless           ");
+    for(int i=0;i<4;i++)
+      delete ends[i];
+  }
+  {
+    SegmentedQueue<int> ping, pong;
+    IQueue<int>* ends[4] = { ping.CreateAccessor(), ping.CreateAccessor(),
+                             pong.CreateAccessor(), pong.CreateAccessor() };
+    spsc_pair(ends[0], ends[1], ends[2], ends[3], iterations, rounds, "Segments           ");
+    for(int i=0;i<4;i++)
+      delete ends[i];
+  }
+}
+
+// Many producer threads, one consumer draining a mailbox.
+// Messages already live on the heap and only pointers are queued.
+struct Mail : MPSCHook {
+  int Value;
+};
+
+void mpsc_producer(IQueue<Mail*>* q, Mail* mail, int count, long* sum){
+  for(int i=0;i<count;i++){
+    q->Enqueue(&mail[i]);
+    *sum += mail[i].Value;
+  }
+}
+
+// Each producer end gets count messages from mail, the
+// calling thread drains all of them from the consumer end.
+void mpsc_run(IQueue<Mail*>** producers, IQueue<Mail*>* consumer, Mail* mail,
+              int count, int num_producers, const char* name){
+  long sums[num_producers];
+  pthread_t threads[num_producers];
+  long sum = 0;
+  Mail* m;
+  Ticks begin = ClockGetTime();
+  for(int i=0;i<num_producers;i++){
+    sums[i] = 0;
+    threads[i] = makeThread(std::tr1::bind(&mpsc_producer, producers[i], mail + i*count, count, &sums[i]));
+  }
+  for(int i=0;i<count*num_producers;i++){
+    while(!consumer->Dequeue(&m))
+      sched_yield();
+    sum -= m->Value;
+  }
+  for(int i=0;i<num_producers;i++){
+    pthread_join(threads[i], NULL);
+    sum += sums[i];
+  }
+  Ticks end = ClockGetTime();
+  RESULT(name);
+}
+
+void mpsc_tests(int iterations, int num_producers){
+  int count = iterations / num_producers;
+  Mail* mail = new Mail[count * num_producers];
+  for(int i=0;i<count*num_producers;i++)
+    mail[i].Value = i % 37;
+
+  printf("\nMany Producer Single Consumer Tests\n");
+  {
+    MPSCQueue<Mail> mpsc;
+    IQueue<Mail*>* ends[num_producers];
+    for(int i=0;i<num_producers;i++)
+      ends[i] = &mpsc;
+    mpsc_run(ends, &mpsc, mail, count, num_producers, "MPSC               ");
+  }
+  {
+    LocklessQueue<Mail*> lockless;
+    IQueue<Mail*>* ends[num_producers];
+    for(int i=0;i<num_producers;i++)
+      ends[i] = lockless.CreateAccessor();
+    IQueue<Mail*>* consumer = lockless.CreateAccessor();
+    mpsc_run(ends, consumer, mail, count, num_producers, "Lockless           ");
+    for(int i=0;i<num_producers;i++)
+      delete ends[i];
+    delete consumer;
+  }
+  delete[] mail;
+}
+
+// Fork-join: each Fibonacci task forks n-1 as a child task,
+// computes n-2 itself and then waits for the child.  Below
+// the cutoff the rest is computed without tasks.
+long fib_serial(int n){
+  return n < 2 ? n : fib_serial(n-1) + fib_serial(n-2);
+}
+
+long fib_fork(TaskExecutor* executor, int n, int cutoff);
+
+struct FibTask : Task {
+  TaskExecutor* Executor;
+  int N;
+  int Cutoff;
+  long Result;
+  FibTask(TaskExecutor* executor, int n, int cutoff) : Executor(executor), N(n), Cutoff(cutoff), Result(0) {}
+  void Run() { this->Result = fib_fork(this->Executor, this->N, this->Cutoff); }
+};
+
+long fib_fork(TaskExecutor* executor, int n, int cutoff){
+  if(n <= cutoff) return fib_serial(n);
+  FibTask child(executor, n-1, cutoff);
+  TaskGroup group;
+  executor->Submit(&child, &group);
+  long other = fib_fork(executor, n-2, cutoff);
+  executor->Wait(&group);
+  return child.Result + other;
+}
+
+void fork_join(int n, int cutoff, int num_threads, bool workStealing, const char* name){
+  long expected = fib_serial(n);
+  TaskExecutor executor(num_threads, workStealing);
+  Ticks begin = ClockGetTime();
+  FibTask root(&executor, n, cutoff);
+  TaskGroup group;
+  executor.Submit(&root, &group);
+  executor.Wait(&group);
+  Ticks end = ClockGetTime();
+  long sum = root.Result - expected;
+  RESULT(name);
+}
+
+void fork_join_tests(int threads){
+  printf("\nFork-Join Fibonacci Tests\n");
+  fork_join(30, 12, threads, true, "Work Stealing      ");
+  fork_join(30, 12, threads, false, "Shared Lockless    ");
+}
+
+// Like random_worker, but times every operation with CycleClock
+// and records it in the thread's own histograms.  Dequeues that
+// find the queue empty are timed too.
+void latency_worker(IQueue<int>* q, int iterations, const WorkProfile& work, int* randoms, int offset,
+                    LatencyHistogram* enq, LatencyHistogram* deq, long* sum){
+  WorkDelay delay(work, work_seed());
+  int x = 0;
+  long localSum = 0;
+  for(int i=0;i<iterations;i++){
+    int r = randoms[offset+i];
+    delay.Pause();
+    if(r % 2 == 0){
+      x = r % 37;
+      uint64_t start = CycleClock::Now();
+      q->Enqueue(x);
+      enq->Record(CycleClock::Now() - start);
+      localSum += x;
+    }else{
+      uint64_t start = CycleClock::Now();
+      bool found = q->Dequeue(&x);
+      deq->Record(CycleClock::Now() - start);
+      if(found)
+        localSum -= x;
+    }
+  }
+  *sum += localSum;
+}
+
+// Prints the percentiles of h, converted from ticks to nanoseconds
+void print_latency(const char* name, const char* op, const LatencyHistogram& h){
+  double scale = CycleClock::NanosPerTick();
+  printf("%s\t%s\tp50 %6.0f\tp90 %6.0f\tp99 %7.0f\tp99.9 %8.0f\tmax %9.0f ns\n", name, op,
+         h.Percentile(0.5) * scale, h.Percentile(0.9) * scale, h.Percentile(0.99) * scale,
+         h.Percentile(0.999) * scale, h.Max() * scale);
+}
+
+// Runs latency_worker on one end per thread, then merges the
+// histograms and reports them.  ends[0] also drains the queue.
+void latency_run(IQueue<int>** ends, int iterations, const WorkProfile& work, int* randoms, int num_threads, const char* name){
+  // Allocated up front, nothing allocates while timing
+  LatencyHistogram* enq = new LatencyHistogram[num_threads];
+  LatencyHistogram* deq = new LatencyHistogram[num_threads];
+  pthread_t threads[num_threads];
+  long sums[num_threads];
+  int n = iterations / num_threads;
+  for(int i=0;i<num_threads;i++){
+    sums[i] = 0;
+    threads[i] = makeThread(std::tr1::bind(&latency_worker, ends[i], n, work, randoms, n*i, &enq[i], &deq[i], &sums[i]));
+  }
+  for(int i=0;i<num_threads;i++)
+    pthread_join(threads[i],NULL);
+  long sum = 0;
+  for(int i=0;i<num_threads;i++){
+    sum += sums[i];
+    if(i > 0){
+      enq[0].Merge(enq[i]);
+      deq[0].Merge(deq[i]);
+    }
+  }
+  sum -= empty_queue(ends[0]);
+  if(sum != 0) printf("%s\tFAIL\n", name);
+  print_latency(name, "Enqueue", enq[0]);
+  print_latency(name, "Dequeue", deq[0]);
+  delete[] enq;
+  delete[] deq;
+}
+
+template<class Q>
+void latency_concurrent_shared(int iterations, const WorkProfile& work, int* randoms, int num_threads, const char* name){
+  Q q;
+  IQueue<int>* ends[num_threads];
+  for(int i=0;i<num_threads;i++)
+    ends[i] = &q;
+  latency_run(ends, iterations, work, randoms, num_threads, name);
+}
+
+template<class Q>
+void latency_concurrent_lockless(int iterations, const WorkProfile& work, int* randoms, int num_threads, const char* name){
+  Q lockless;
+  IQueue<int>* ends[num_threads];
+  for(int i=0;i<num_threads;i++)
+    ends[i] = lockless.CreateAccessor();
+  latency_run(ends, iterations, work, randoms, num_threads, name);
+  for(int i=0;i<num_threads;i++)
+    delete ends[i];
+}
+
+// Sized like random_concurrent_bounded so Enqueue never finds it full
+void latency_concurrent_bounded(int iterations, const WorkProfile& work, int* randoms, int num_threads){
+  BoundedQueue<int> bounded(iterations);
+  IQueue<int>* ends[num_threads];
+  for(int i=0;i<num_threads;i++)
+    ends[i] = &bounded;
+  latency_run(ends, iterations, work, randoms, num_threads, "Concurrent Bounded ");
+}
+
+void latency_tests(int iterations, const WorkProfile& work, int threads){
+  printf("\nRandom Operation Latency (%s clock)\n", CycleClock::Source());
+  int* randoms = new int[iterations];
+  srand(time(0));
+  for(int i=0;i<iterations;i++)
+    randoms[i] = rand();
+  latency_concurrent_shared<LockingQueue<int> >(iterations, work, randoms, threads, "Concurrent Locking ");
+  latency_concurrent_shared<FlatCombiningQueue<int> >(iterations, work, randoms, threads, "Concurrent Combining");
+  latency_concurrent_lockless<HPQueue>(iterations, work, randoms, threads, "Concurrent Lockless");
+  latency_concurrent_lockless<EBRQueue>(iterations, work, randoms, threads, "Concurrent EBR     ");
+  latency_concurrent_lockless<SegQueue>(iterations, work, randoms, threads, "Concurrent Segments");
+  latency_concurrent_bounded(iterations, work, randoms, threads);
+  delete[] randoms;
+}
+
+// Runs the two lock queue with every lock policy from Locks.h
+void lock_tests(int iterations, const WorkProfile& work, int threads, int bias, int batch){
+  printf("\nLock Policy Random Tests\n");
+  int* randoms = new int[iterations];
+  srand(time(0));
+  for(int i=0;i<iterations;i++)
+    randoms[i] = rand();
+  random_concurrent_shared<LockingQueue<int, PthreadMutex> >(iterations, work, randoms, threads, "Pthread Mutex      ");
+  random_concurrent_shared<LockingQueue<int, TTASLock> >(iterations, work, randoms, threads, "TTAS Backoff       ");
+  random_concurrent_shared<LockingQueue<int, TicketLock> >(iterations, work, randoms, threads, "Ticket             ");
+  random_concurrent_shared<LockingQueue<int, MCSLock> >(iterations, work, randoms, threads, "MCS                ");
+  random_concurrent_shared<LockingQueue<int, AdaptiveLock> >(iterations, work, randoms, threads, "Adaptive Futex     ");
+  delete[] randoms;
+
+  iterations /= (bias+1) * batch;
+  printf("\nLock Policy Enqueue Bias Series Tests\n");
+  series_concurrent_shared<LockingQueue<int, PthreadMutex> >(iterations, work, bias, 1, batch, threads, "Pthread Mutex      ");
+  series_concurrent_shared<LockingQueue<int, TTASLock> >(iterations, work, bias, 1, batch, threads, "TTAS Backoff       ");
+  series_concurrent_shared<LockingQueue<int, TicketLock> >(iterations, work, bias, 1, batch, threads, "Ticket             ");
+  series_concurrent_shared<LockingQueue<int, MCSLock> >(iterations, work, bias, 1, batch, threads, "MCS                ");
+  series_concurrent_shared<LockingQueue<int, AdaptiveLock> >(iterations, work, bias, 1, batch, threads, "Adaptive Futex     ");
+}
+
+/************** Scenario Driver **************/
+
+// Queue element of a given size.  Value is what the sum check
+// adds up and Stamp is the CycleClock time it was enqueued, the
+// payload is only copied along with them.
+template<int Bytes>
+struct Item {
+  long Value;
+  uint64_t Stamp;
+  char Payload[Bytes - sizeof(long) - sizeof(uint64_t)];
+  Item() : Value(0), Stamp(0) {}
+  Item(long value, uint64_t stamp = 0) : Value(value), Stamp(stamp) {}
+};
+
+template<>
+struct Item<sizeof(long) + sizeof(uint64_t)> {
+  long Value;
+  uint64_t Stamp;
+  Item() : Value(0), Stamp(0) {}
+  Item(long value, uint64_t stamp = 0) : Value(value), Stamp(stamp) {}
+};
+
+// A queue under test, as seen by the scenario workers
+template<class E>
+class Subject {
+public:
+  virtual ~Subject() {}
+  // End of the queue for the calling thread
+  virtual IQueue<E>* Open() = 0;
+  virtual void Close(IQueue<E>*) {}
+  // Returns false instead of waiting when a bounded queue is full
+  virtual bool Offer(IQueue<E>* end, const E& value) {
+    end->Enqueue(value);
+    return true;
+  }
+};
+
+template<class E, class Q>
+class SharedSubject : public Subject<E> {
+private:
+  Q q;
+public:
+  IQueue<E>* Open() { return &this->q; }
+};
+
+template<class E, class Q>
+class AccessorSubject : public Subject<E> {
+private:
+  Q q;
+public:
+  IQueue<E>* Open() { return this->q.CreateAccessor(); }
+  void Close(IQueue<E>* end) { delete end; }
+};
+
+template<class E>
+class BoundedSubject : public Subject<E> {
+private:
+  BoundedQueue<E> q;
+public:
+  BoundedSubject(size_t capacity) : q(capacity) {}
+  IQueue<E>* Open() { return &this->q; }
+  bool Offer(IQueue<E>*, const E& value) { return this->q.TryEnqueue(value); }
+};
+
+template<class E, class Shard>
+class ShardedSubject : public Subject<E> {
+private:
+  ShardedQueue<E, Shard> q;
+public:
+  ShardedSubject(int shards, ShardPolicy policy) : q(shards, policy) {}
+  IQueue<E>* Open() { return &this->q; }
+};
+
+const char* queue_names[] = {
+  "locking", "locking-ttas", "locking-ticket", "locking-mcs", "locking-adaptive",
+  "combining", "lockless", "ebr", "segments", "bounded", "sharded", "sharded-rr", 0
+};
+
+// Returns 0 for an unknown name
+template<class E>
+Subject<E>* make_subject(const std::string& name, size_t capacity, int threads){
+  if(name == "locking") return new SharedSubject<E, LockingQueue<E> >();
+  if(name == "locking-ttas") return new SharedSubject<E, LockingQueue<E, TTASLock> >();
+  if(name == "locking-ticket") return new SharedSubject<E, LockingQueue<E, TicketLock> >();
+  if(name == "locking-mcs") return new SharedSubject<E, LockingQueue<E, MCSLock> >();
+  if(name == "locking-adaptive") return new SharedSubject<E, LockingQueue<E, AdaptiveLock> >();
+  if(name == "combining") return new SharedSubject<E, FlatCombiningQueue<E> >();
+  if(name == "lockless") return new AccessorSubject<E, LocklessQueue<E> >();
+  if(name == "ebr") return new AccessorSubject<E, LocklessQueue<E, EpochReclamation<Node<E> > > >();
+  if(name == "segments") return new AccessorSubject<E, SegmentedQueue<E> >();
+  if(name == "bounded") return new BoundedSubject<E>(capacity);
+  if(name == "sharded") return new ShardedSubject<E, LocklessQueue<E> >(threads, ShardTwoChoice);
+  if(name == "sharded-rr") return new ShardedSubject<E, LocklessQueue<E> >(threads, ShardRoundRobin);
+  return 0;
+}
+
+struct Options {
+  std::string Scenario; // suite, mixed or pc
+  std::vector<std::string> Queues;
+  std::vector<int> Threads; // mixed
+  std::vector<int> Producers; // pc
+  std::vector<int> Consumers; // pc
+  std::vector<std::pair<int, int> > Ratios; // pc, replaces the two above
+  int EnqueuePercent; // mixed op mix
+  int ElementSize;
+  long Ops; // total per run, unless Duration is set
+  double Duration; // seconds
+  int Reps;
+  int Warmup;
+  WorkProfile Work; // Spun between operations
+  long Capacity; // of the bounded queue
+  std::string Placement; // none, compact, scatter, smt or list
+  std::vector<int> PlacementCpus; // Thread i runs on entry i % size, empty if unpinned
+  bool Perf; // Collect hardware counters
+  std::string PerfStatus; // What --perf found, for the metadata
+  std::string JsonPath;
+  std::string CsvPath;
+  // Suite only
+  int Iterations;
+  int Bias;
+  int Batch;
+};
+
+// One run's workers share this
+struct RunControl {
+  pthread_barrier_t Start;
+  int Stop; // Set when the duration is up
+  int ProducersLeft;
+};
+
+// Written by one worker, padded so workers don't share lines
+struct ThreadResult {
+  char padding0[64];
+  long Ops; // Successful enqueues and dequeues
+  long Sum; // Values enqueued minus values dequeued
+  long Dequeues; // Dequeue calls, including empty ones
+  long Empty; // Dequeues that found the queue empty
+  long Full; // Enqueues that found a bounded queue full
+  LatencyHistogram* Latency; // Enqueue to dequeue, consumers only
+  uint64_t Perf[PerfCounters::Count];
+  bool PerfOpen[PerfCounters::Count]; // Counter was available
+  char padding1[64];
+};
+
+// Counts the calling worker's hardware events from Start to
+// Finish when --perf is on.  Opened before the start barrier,
+// so the syscalls aren't timed.
+class WorkerCounters {
+private:
+  PerfCounters* counters;
+public:
+  WorkerCounters(bool enabled) : counters(enabled ? new PerfCounters() : 0) {}
+  ~WorkerCounters() { delete counters; }
+
+  void Start() {
+    if(this->counters) this->counters->Start();
+  }
+
+  void Finish(ThreadResult* r) {
+    if(!this->counters) return;
+    this->counters->Stop();
+    this->counters->Read(r->Perf);
+    for(int i=0;i<PerfCounters::Count;i++)
+      r->PerfOpen[i] = this->counters->Available(i);
+  }
+};
+
+// Adds up the repetitions of one configuration
+struct RunTotals {
+  bool Pass;
+  long Dequeues;
+  long Empty;
+  long Full;
+  LatencyHistogram Latency;
+  long Ops;
+  uint64_t Perf[PerfCounters::Count];
+  bool PerfOpen[PerfCounters::Count]; // In every thread of every run
+  RunTotals() : Pass(true), Dequeues(0), Empty(0), Full(0), Ops(0) {
+    for(int i=0;i<PerfCounters::Count;i++){
+      this->Perf[i] = 0;
+      this->PerfOpen[i] = true;
+    }
+  }
+};
+
+// One scenario, queue and thread count, over every repetition
+struct Result {
+  std::string Scenario;
+  std::string Queue;
+  int Threads;
+  int Producers;
+  int Consumers;
+  int ElementSize;
+  std::string Placement;
+  std::vector<int> Cpus; // Of each thread, producers first
+  std::vector<double> Rates; // Operations per second, one per rep
+  bool Pass;
+  double Mean;
+  double Stddev;
+  double EmptyRate; // Fraction of dequeues that found nothing
+  long Full;
+  // End to end item latency in ns, pc only
+  bool HasLatency;
+  double P50, P90, P99, P999, Max;
+  // Hardware events per successful operation, with --perf
+  bool HasPerf;
+  bool PerfOpen[PerfCounters::Count];
+  double PerfPerOp[PerfCounters::Count];
+};
+
+inline bool keep_going(RunControl* ctl, long i, long ops){
+  return ops ? i < ops : !__atomic_load_n(&ctl->Stop, __ATOMIC_RELAXED);
+}
+
+// Every thread enqueues or dequeues at random, enqueuing
+// EnqueuePercent of the time
+template<class E>
+void mixed_worker(Subject<E>* subject, RunControl* ctl, const Options* opt, long ops, unsigned seed, ThreadResult* r){
+  IQueue<E>* q = subject->Open();
+  WorkDelay delay(opt->Work, seed);
+  E item;
+  long done = 0, sum = 0, dequeues = 0, empty = 0, full = 0;
+  unsigned x = seed;
+  WorkerCounters counters(opt->Perf);
+  pthread_barrier_wait(&ctl->Start);
+  counters.Start();
+  for(long i=0;keep_going(ctl, i, ops);i++){
+    delay.Pause();
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    if((int)(x % 100) < opt->EnqueuePercent){
+      long v = i % 37;
+      if(subject->Offer(q, E(v))){
+        sum += v;
+        done++;
+      }else{
+        full++;
+      }
+    }else{
+      dequeues++;
+      if(q->Dequeue(&item)){
+        sum -= item.Value;
+        done++;
+      }else{
+        empty++;
+      }
+    }
+  }
+  counters.Finish(r);
+  r->Ops = done;
+  r->Sum = sum;
+  r->Dequeues = dequeues;
+  r->Empty = empty;
+  r->Full = full;
+  subject->Close(q);
+}
+
+// Waits for room when a bounded queue is full, so every item
+// counted is one that went through.  Items are stamped just
+// before the enqueue that publishes them.
+template<class E>
+void producer_worker(Subject<E>* subject, RunControl* ctl, const Options* opt, long ops, unsigned seed, ThreadResult* r){
+  IQueue<E>* q = subject->Open();
+  WorkDelay delay(opt->Work, seed);
+  long done = 0, sum = 0, full = 0;
+  WorkerCounters counters(opt->Perf);
+  pthread_barrier_wait(&ctl->Start);
+  counters.Start();
+  for(long i=0;keep_going(ctl, i, ops);i++){
+    delay.Pause();
+    long v = i % 37;
+    bool offered;
+    for(int tries=1;!(offered = subject->Offer(q, E(v, CycleClock::Now())));tries++){
+      // Count the item once, not every retry it takes
+      if(tries == 1) full++;
+      if(__atomic_load_n(&ctl->Stop, __ATOMIC_RELAXED)) break;
+      if(tries % 64 == 0) sched_yield();
+      else CpuRelax();
+    }
+    if(offered){
+      sum += v;
+      done++;
+    }
+  }
+  counters.Finish(r);
+  __sync_fetch_and_sub(&ctl->ProducersLeft, 1);
+  r->Ops = done;
+  r->Sum = sum;
+  r->Full = full;
+  subject->Close(q);
+}
+
+// Dequeues until the producers are done and the queue looks empty.
+// Yields now and then while it is empty so that on a small machine
+// the producers get to run.
+template<class E>
+void consumer_worker(Subject<E>* subject, RunControl* ctl, const Options* opt, unsigned seed, ThreadResult* r){
+  IQueue<E>* q = subject->Open();
+  WorkDelay delay(opt->Work, seed);
+  E item;
+  long done = 0, sum = 0, dequeues = 0, empty = 0;
+  int misses = 0;
+  bool finishing = false; // Producers are done, stop once empty
+  WorkerCounters counters(opt->Perf);
+  pthread_barrier_wait(&ctl->Start);
+  counters.Start();
+  while(true){
+    dequeues++;
+    if(q->Dequeue(&item)){
+      r->Latency->Record(CycleClock::Now() - item.Stamp);
+      sum -= item.Value;
+      done++;
+      misses = 0;
+      delay.Pause();
+      continue;
+    }
+    empty++;
+    if(finishing) break;
+    if(__atomic_load_n(&ctl->ProducersLeft, __ATOMIC_ACQUIRE) == 0){
+      finishing = true;
+      continue;
+    }
+    if(++misses % 64 == 0) sched_yield();
+    else CpuRelax();
+  }
+  counters.Finish(r);
+  r->Ops = done;
+  r->Sum = sum;
+  r->Dequeues = dequeues;
+  r->Empty = empty;
+  subject->Close(q);
+}
+
+// Runs one repetition and returns operations per second.
+// Adds its counts to totals, and clears totals->Pass if
+// the values don't add up.
+template<class E>
+double run_once(const Options& opt, const std::string& queue, int producers, int consumers, bool mixed, RunTotals* totals){
+  int n = producers + consumers;
+  Subject<E>* subject = make_subject<E>(queue, opt.Capacity, n);
+  RunControl ctl;
+  pthread_barrier_init(&ctl.Start, 0, n + 1);
+  ctl.Stop = 0;
+  ctl.ProducersLeft = producers;
+  ThreadResult* results = new ThreadResult[n];
+  pthread_t threads[n];
+  long ops = opt.Duration > 0 ? 0 : opt.Ops / (mixed ? n : producers);
+  if(ops == 0 && opt.Duration <= 0) ops = 1;
+  // Allocated up front, nothing allocates while timing
+  LatencyHistogram* latency = mixed ? 0 : new LatencyHistogram[consumers];
+  for(int i=0;i<n;i++){
+    results[i].Ops = results[i].Sum = 0;
+    results[i].Dequeues = results[i].Empty = results[i].Full = 0;
+    for(int j=0;j<PerfCounters::Count;j++){
+      results[i].Perf[j] = 0;
+      results[i].PerfOpen[j] = false;
+    }
+    results[i].Latency = !mixed && i >= producers ? &latency[i - producers] : 0;
+    int cpu = opt.PlacementCpus.empty() ? -1 : opt.PlacementCpus[i % opt.PlacementCpus.size()];
+    unsigned seed = (unsigned)(i+1) * 2654435761u;
+    if(mixed)
+      threads[i] = makeThread(std::tr1::bind(&mixed_worker<E>, subject, &ctl, &opt, ops, seed, &results[i]), cpu);
+    else if(i < producers)
+      threads[i] = makeThread(std::tr1::bind(&producer_worker<E>, subject, &ctl, &opt, ops, seed, &results[i]), cpu);
+    else
+      threads[i] = makeThread(std::tr1::bind(&consumer_worker<E>, subject, &ctl, &opt, seed, &results[i]), cpu);
+  }
+  pthread_barrier_wait(&ctl.Start);
+  uint64_t begin = MonotonicNanos();
+  if(opt.Duration > 0){
+    usleep((useconds_t)(opt.Duration * 1e6));
+    __atomic_store_n(&ctl.Stop, 1, __ATOMIC_RELAXED);
+  }
+  for(int i=0;i<n;i++)
+    pthread_join(threads[i], NULL);
+  uint64_t end = MonotonicNanos();
+  long total = 0, sum = 0;
+  for(int i=0;i<n;i++){
+    total += results[i].Ops;
+    sum += results[i].Sum;
+    totals->Dequeues += results[i].Dequeues;
+    totals->Empty += results[i].Empty;
+    totals->Full += results[i].Full;
+    if(results[i].Latency) totals->Latency.Merge(*results[i].Latency);
+    for(int j=0;j<PerfCounters::Count;j++){
+      totals->Perf[j] += results[i].Perf[j];
+      totals->PerfOpen[j] = totals->PerfOpen[j] && results[i].PerfOpen[j];
+    }
+  }
+  totals->Ops += total;
+  // Whatever consumers left behind in a duration run
+  IQueue<E>* rest = subject->Open();
+  E item;
+  while(rest->Dequeue(&item))
+    sum -= item.Value;
+  subject->Close(rest);
+  if(sum != 0) totals->Pass = false;
+  pthread_barrier_destroy(&ctl.Start);
+  delete[] latency;
+  delete[] results;
+  delete subject;
+  return total / ((end - begin) / 1e9);
+}
+
+std::string cpu_string(const std::vector<int>& cpus, const char* separator){
+  std::string s;
+  char buffer[16];
+  for(size_t i=0;i<cpus.size();i++){
+    snprintf(buffer, sizeof(buffer), "%s%d", i ? separator : "", cpus[i]);
+    s += buffer;
+  }
+  return s;
+}
+
+void summarize(Result* r){
+  double mean = 0, var = 0;
+  for(size_t i=0;i<r->Rates.size();i++)
+    mean += r->Rates[i];
+  mean /= r->Rates.size();
+  for(size_t i=0;i<r->Rates.size();i++)
+    var += (r->Rates[i] - mean) * (r->Rates[i] - mean);
+  r->Mean = mean;
+  r->Stddev = r->Rates.size() > 1 ? sqrt(var / (r->Rates.size() - 1)) : 0;
+}
+
+template<class E>
+Result run_config(const Options& opt, const std::string& queue, int producers, int consumers, bool mixed){
+  Result r;
+  r.Scenario = opt.Scenario;
+  r.Queue = queue;
+  r.Threads = producers + consumers;
+  r.Producers = mixed ? 0 : producers;
+  r.Consumers = mixed ? 0 : consumers;
+  r.ElementSize = sizeof(E);
+  r.Placement = opt.Placement;
+  for(int i=0;!opt.PlacementCpus.empty() && i<r.Threads;i++)
+    r.Cpus.push_back(opt.PlacementCpus[i % opt.PlacementCpus.size()]);
+
+  // The queue is built by this thread, so while pinned it
+  // runs next to the first worker, and allocates from its node
+  cpu_set_t unpinned;
+  bool pinned = !r.Cpus.empty() && sched_getaffinity(0, sizeof(unpinned), &unpinned) == 0 &&
+                PinThread(pthread_self(), r.Cpus[0]);
+
+  // Warmup runs only count towards the sum check
+  RunTotals warmup, totals;
+  for(int i=0;i<opt.Warmup;i++)
+    run_once<E>(opt, queue, producers, consumers, mixed, &warmup);
+  for(int i=0;i<opt.Reps;i++)
+    r.Rates.push_back(run_once<E>(opt, queue, producers, consumers, mixed, &totals));
+  if(pinned)
+    pthread_setaffinity_np(pthread_self(), sizeof(unpinned), &unpinned);
+  summarize(&r);
+  r.Pass = warmup.Pass && totals.Pass;
+  r.EmptyRate = totals.Dequeues ? (double)totals.Empty / totals.Dequeues : 0;
+  r.Full = totals.Full;
+  r.HasLatency = totals.Latency.Count() > 0;
+  double scale = CycleClock::NanosPerTick();
+  r.P50 = totals.Latency.Percentile(0.5) * scale;
+  r.P90 = totals.Latency.Percentile(0.9) * scale;
+  r.P99 = totals.Latency.Percentile(0.99) * scale;
+  r.P999 = totals.Latency.Percentile(0.999) * scale;
+  r.Max = totals.Latency.Max() * scale;
+  r.HasPerf = opt.Perf;
+  for(int i=0;i<PerfCounters::Count;i++){
+    r.PerfOpen[i] = opt.Perf && totals.PerfOpen[i];
+    r.PerfPerOp[i] = totals.Ops ? (double)totals.Perf[i] / totals.Ops : 0;
+  }
+
+  char threads[32];
+  if(mixed) snprintf(threads, sizeof(threads), "%d", r.Threads);
+  else snprintf(threads, sizeof(threads), "%dp/%dc", producers, consumers);
+  printf("%-6s %-17s %8s %5d B\t%s\t%10.3f Mops/s  sd %7.3f  empty %5.1f%%", r.Scenario.c_str(), queue.c_str(),
+         threads, r.ElementSize, r.Pass ? "PASS" : "FAIL", r.Mean / 1e6, r.Stddev / 1e6, r.EmptyRate * 100);
+  if(!r.Cpus.empty())
+    printf("  %s %s", r.Placement.c_str(), cpu_string(r.Cpus, ",").c_str());
+  if(r.Full)
+    printf("  full %ld", r.Full);
+  if(r.HasLatency)
+    printf("  latency p50 %.0f p99 %.0f p99.9 %.0f max %.0f ns", r.P50, r.P99, r.P999, r.Max);
+  printf("\n");
+  if(r.HasPerf){
+    printf("       per op:");
+    for(int i=0;i<PerfCounters::Count;i++){
+      if(r.PerfOpen[i]) printf("  %s %.2f", PerfCounters::Name(i), r.PerfPerOp[i]);
+      else printf("  %s n/a", PerfCounters::Name(i));
+    }
+    if(r.PerfOpen[PerfCounters::Cycles] && r.PerfOpen[PerfCounters::Instructions] && r.PerfPerOp[PerfCounters::Cycles] > 0)
+      printf("  ipc %.2f", r.PerfPerOp[PerfCounters::Instructions] / r.PerfPerOp[PerfCounters::Cycles]);
+    printf("\n");
+  }
+  fflush(stdout);
+  return r;
+}
+
+template<class E>
+void run_scenarios(const Options& opt, std::vector<Result>* results){
+  bool mixed = opt.Scenario == "mixed";
+  for(size_t q=0;q<opt.Queues.size();q++){
+    if(mixed){
+      for(size_t t=0;t<opt.Threads.size();t++)
+        results->push_back(run_config<E>(opt, opt.Queues[q], opt.Threads[t], 0, true));
+    }else if(!opt.Ratios.empty()){
+      for(size_t i=0;i<opt.Ratios.size();i++)
+        results->push_back(run_config<E>(opt, opt.Queues[q], opt.Ratios[i].first, opt.Ratios[i].second, false));
+    }else{
+      for(size_t p=0;p<opt.Producers.size();p++)
+        for(size_t c=0;c<opt.Consumers.size();c++)
+          results->push_back(run_config<E>(opt, opt.Queues[q], opt.Producers[p], opt.Consumers[c], false));
+    }
+  }
+}
+
+const char* work_name(ConcurrentQueues::WorkDistribution d){
+  return d == WorkExponential ? "exponential" : d == WorkUniform ? "uniform" : "fixed";
+}
+
+typedef std::vector<std::pair<std::string, std::string> > Metadata;
+
+// Host, compiler and clock details recorded with every result file
+Metadata collect_metadata(const Options& opt){
+  Metadata m;
+  char buffer[256];
+  if(gethostname(buffer, sizeof(buffer)) == 0){
+    buffer[sizeof(buffer)-1] = 0;
+    m.push_back(std::make_pair(std::string("host"), std::string(buffer)));
+  }
+  utsname u;
+  if(uname(&u) == 0){
+    m.push_back(std::make_pair(std::string("kernel"), std::string(u.sysname) + " " + u.release));
+    m.push_back(std::make_pair(std::string("machine"), std::string(u.machine)));
+  }
+  FILE* f = fopen("/proc/cpuinfo", "r");
+  if(f){
+    char line[512];
+    while(fgets(line, sizeof(line), f)){
+      if(strncmp(line, "model name", 10) != 0) continue;
+      char* value = strchr(line, ':');
+      if(!value) break;
+      value += strspn(value, ": \t");
+      value[strcspn(value, "\n")] = 0;
+      m.push_back(std::make_pair(std::string("cpu"), std::string(value)));
+      break;
+    }
+    fclose(f);
+  }
+  snprintf(buffer, sizeof(buffer), "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+  m.push_back(std::make_pair(std::string("cpus_online"), std::string(buffer)));
+  CpuTopology topology;
+  snprintf(buffer, sizeof(buffer), "%d sockets, %d cores, %d cpus allowed, %d numa nodes",
+           topology.PackageCount(), topology.CoreCount(), topology.CpuCount(), topology.NodeCount());
+  m.push_back(std::make_pair(std::string("topology"), std::string(buffer)));
+  m.push_back(std::make_pair(std::string("placement"), opt.Placement));
+  m.push_back(std::make_pair(std::string("perf"), opt.PerfStatus));
+#if defined(__clang__)
+  m.push_back(std::make_pair(std::string("compiler"), std::string("clang ") + __clang_version__));
+#elif defined(__GNUC__)
+  m.push_back(std::make_pair(std::string("compiler"), std::string("gcc ") + __VERSION__));
+#endif
+#if defined(__OPTIMIZE__)
+  m.push_back(std::make_pair(std::string("optimized"), std::string("yes")));
+#else
+  m.push_back(std::make_pair(std::string("optimized"), std::string("no")));
+#endif
+  time_t now = time(0);
+  strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  m.push_back(std::make_pair(std::string("date"), std::string(buffer)));
+  m.push_back(std::make_pair(std::string("clock"), std::string(CycleClock::Source())));
+  snprintf(buffer, sizeof(buffer), "%d", opt.EnqueuePercent);
+  m.push_back(std::make_pair(std::string("enqueue_percent"), std::string(buffer)));
+  snprintf(buffer, sizeof(buffer), "%s %g ns", work_name(opt.Work.Distribution), opt.Work.MeanNanos);
+  m.push_back(std::make_pair(std::string("work"), std::string(buffer)));
+  snprintf(buffer, sizeof(buffer), "%.3f", SpinWork::LoopsPerNano());
+  m.push_back(std::make_pair(std::string("work_loops_per_ns"), std::string(buffer)));
+  if(opt.Duration > 0) snprintf(buffer, sizeof(buffer), "%gs", opt.Duration);
+  else snprintf(buffer, sizeof(buffer), "%ld ops", opt.Ops);
+  m.push_back(std::make_pair(std::string("length"), std::string(buffer)));
+  snprintf(buffer, sizeof(buffer), "%d", opt.Warmup);
+  m.push_back(std::make_pair(std::string("warmup"), std::string(buffer)));
+  return m;
+}
+
+std::string json_string(const std::string& s){
+  std::string out = "\"";
+  for(size_t i=0;i<s.size();i++){
+    char c = s[i];
+    if(c == '"' || c == '\\') out += '\\';
+    if((unsigned char)c < 0x20) c = ' ';
+    out += c;
+  }
+  return out + "\"";
+}
+
+bool write_json(const char* path, const Metadata& meta, const std::vector<Result>& results){
+  FILE* f = fopen(path, "w");
+  if(!f) return false;
+  fprintf(f, "{\n  \"metadata\": {");
+  for(size_t i=0;i<meta.size();i++)
+    fprintf(f, "%s\n    %s: %s", i ? "," : "", json_string(meta[i].first).c_str(), json_string(meta[i].second).c_str());
+  fprintf(f, "\n  },\n  \"results\": [");
+  for(size_t i=0;i<results.size();i++){
+    const Result& r = results[i];
+    fprintf(f, "%s\n    {\"scenario\": %s, \"queue\": %s, \"threads\": %d, \"producers\": %d, \"consumers\": %d, "
+            "\"element_size\": %d, \"pass\": %s, \"mean_ops_per_sec\": %.1f, \"stddev_ops_per_sec\": %.1f, "
+            "\"empty_dequeue_rate\": %.4f, \"full_enqueues\": %ld, ",
+            i ? "," : "", json_string(r.Scenario).c_str(), json_string(r.Queue).c_str(), r.Threads, r.Producers,
+            r.Consumers, r.ElementSize, r.Pass ? "true" : "false", r.Mean, r.Stddev, r.EmptyRate, r.Full);
+    fprintf(f, "\"placement\": %s, \"cpus\": [%s], ", json_string(r.Placement).c_str(), cpu_string(r.Cpus, ", ").c_str());
+    if(r.HasLatency)
+      fprintf(f, "\"latency_ns\": {\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p99.9\": %.0f, \"max\": %.0f}, ",
+              r.P50, r.P90, r.P99, r.P999, r.Max);
+    if(r.HasPerf){
+      fprintf(f, "\"perf_per_op\": {");
+      for(int j=0;j<PerfCounters::Count;j++){
+        if(r.PerfOpen[j]) fprintf(f, "%s\"%s\": %.3f", j ? ", " : "", PerfCounters::Name(j), r.PerfPerOp[j]);
+        else fprintf(f, "%s\"%s\": null", j ? ", " : "", PerfCounters::Name(j));
+      }
+      fprintf(f, "}, ");
+    }
+    fprintf(f, "\"runs\": [");
+    for(size_t j=0;j<r.Rates.size();j++)
+      fprintf(f, "%s%.1f", j ? ", " : "", r.Rates[j]);
+    fprintf(f, "]}");
+  }
+  fprintf(f, "\n  ]\n}\n");
+  return fclose(f) == 0;
+}
+
+// Metadata goes in leading # comment lines
+bool write_csv(const char* path, const Metadata& meta, const std::vector<Result>& results){
+  FILE* f = fopen(path, "w");
+  if(!f) return false;
+  for(size_t i=0;i<meta.size();i++)
+    fprintf(f, "# %s: %s\n", meta[i].first.c_str(), meta[i].second.c_str());
+  fprintf(f, "scenario,queue,threads,producers,consumers,element_size,pass,mean_ops_per_sec,stddev_ops_per_sec,"
+          "empty_dequeue_rate,full_enqueues,placement,cpus,latency_p50_ns,latency_p90_ns,latency_p99_ns,latency_p999_ns,latency_max_ns,");
+  for(int j=0;j<PerfCounters::Count;j++)
+    fprintf(f, "%s_per_op,", PerfCounters::Name(j));
+  fprintf(f, "runs\n");
+  for(size_t i=0;i<results.size();i++){
+    const Result& r = results[i];
+    fprintf(f, "%s,%s,%d,%d,%d,%d,%s,%.1f,%.1f,%.4f,%ld,", r.Scenario.c_str(), r.Queue.c_str(), r.Threads, r.Producers,
+            r.Consumers, r.ElementSize, r.Pass ? "PASS" : "FAIL", r.Mean, r.Stddev, r.EmptyRate, r.Full);
+    fprintf(f, "%s,%s,", r.Placement.c_str(), cpu_string(r.Cpus, " ").c_str());
+    if(r.HasLatency)
+      fprintf(f, "%.0f,%.0f,%.0f,%.0f,%.0f,", r.P50, r.P90, r.P99, r.P999, r.Max);
+    else
+      fprintf(f, ",,,,,");
+    for(int j=0;j<PerfCounters::Count;j++){
+      if(r.PerfOpen[j]) fprintf(f, "%.3f,", r.PerfPerOp[j]);
+      else fprintf(f, ",");
+    }
+    for(size_t j=0;j<r.Rates.size();j++)
+      fprintf(f, "%s%.1f", j ? " " : "", r.Rates[j]);
+    fprintf(f, "\n");
+  }
+  return fclose(f) == 0;
+}
+
+// Parses "1,2,4,8" or ranges like "1-8", returns false on junk
+bool parse_counts(const char* arg, std::vector<int>* out){
+  out->clear();
+  const char* p = arg;
+  while(*p){
+    char* end;
+    long a = strtol(p, &end, 10);
+    if(end == p || a <= 0) return false;
+    long b = a;
+    if(*end == '-'){
+      p = end + 1;
+      b = strtol(p, &end, 10);
+      if(end == p || b < a) return false;
+    }
+    for(long i=a;i<=b;i++)
+      out->push_back((int)i);
+    if(*end == ',') end++;
+    else if(*end) return false;
+    p = end;
+  }
+  return !out->empty();
+}
+
+// Parses producer:consumer pairs such as "16:1,1:16,4:4"
+bool parse_ratios(const char* arg, std::vector<std::pair<int, int> >* out){
+  out->clear();
+  const char* p = arg;
+  while(*p){
+    char* end;
+    long producers = strtol(p, &end, 10);
+    if(end == p || producers <= 0 || *end != ':') return false;
+    p = end + 1;
+    long consumers = strtol(p, &end, 10);
+    if(end == p || consumers <= 0) return false;
+    out->push_back(std::make_pair((int)producers, (int)consumers));
+    if(*end == ',') end++;
+    else if(*end) return false;
+    p = end;
+  }
+  return !out->empty();
+}
+
+void split_names(const char* arg, std::vector<std::string>* out){
+  out->clear();
+  std::string s(arg);
+  size_t start = 0;
+  while(start <= s.size()){
+    size_t comma = s.find(',', start);
+    if(comma == std::string::npos) comma = s.size();
+    if(comma > start) out->push_back(s.substr(start, comma - start));
+    start = comma + 1;
+  }
+}
+
+void usage(const char* program){
+  printf("Usage: %s [options]\n\n", program);
+  printf("  --scenario=NAME     suite (default, every fixed section), mixed (every thread\n");
+  printf("                      enqueues and dequeues), pc (separate producers and consumers)\n");
+  printf("                      or stall (memory held with a stalled reader, suite settings)\n");
+  printf("  --queues=LIST       comma separated, or 'all' (default locking,combining,lockless,\n");
+  printf("                      ebr,segments,bounded)\n");
+  printf("  --threads=LIST      mixed thread counts to sweep, e.g. 1,2,4,8 or 1-8 (default 8)\n");
+  printf("  --producers=LIST    pc producer counts to sweep (default 1)\n");
+  printf("  --consumers=LIST    pc consumer counts to sweep (default 1)\n");
+  printf("  --ratios=LIST       pc producer:consumer pairs, e.g. 16:1,1:16, instead of the\n");
+  printf("                      two lists above\n");
+  printf("  --mix=PERCENT       mixed enqueue percentage (default 50)\n");
+  printf("  --size=BYTES        element size: 16, 64, 256 or 1024 (default 16)\n");
+  printf("  --ops=N             operations per run, split across threads (default 1000000)\n");
+  printf("  --duration=SECONDS  run for a fixed time instead of --ops\n");
+  printf("  --reps=N            measured repetitions (default 5)\n");
+  printf("  --warmup=N          unmeasured repetitions first (default 1)\n");
+  printf("  --work=NS           mean busy work between operations, in ns (default 100)\n");
+  printf("  --work-dist=NAME    fixed (default), exponential or uniform over [0, 2*NS]\n");
+  printf("  --capacity=N        bounded queue capacity (default 1048576)\n");
+  printf("  --placement=NAME    none (default, unpinned), compact (fill a socket, one thread\n");
+  printf("                      per core first), smt (SMT siblings first) or scatter\n");
+  printf("                      (alternate sockets).  pc places producers first.\n");
+  printf("  --cpus=LIST         pin thread i to the i-th CPU of the list, e.g. 0,32 or 0-3\n");
+  printf("                      (placement is for mixed and pc only)\n");
+  printf("  --perf              count cycles, instructions, L1D and LLC misses and HITM\n");
+  printf("                      loads per operation (includes --work spinning)\n");
+  printf("  --json=FILE         write results and metadata as JSON\n");
+  printf("  --csv=FILE          write results and metadata as CSV\n");
+  printf("  --iterations=N, --bias=N, --batch=N\n");
+  printf("                      suite settings (defaults 1000000, 2, 1)\n");
+  printf("\nEvery result reports the share of dequeues that found the queue empty; pc\n");
+  printf("results also report the latency from enqueue to dequeue of each item.\n");
+  printf("\nQueues:");
+  for(int i=0;queue_names[i];i++)
+    printf(" %s", queue_names[i]);
+  printf("\n");
+}
+
+// Returns false if the program should exit, with *status set
+bool parse_options(int argc, char* argv[], Options* opt, int* status){
+  static const option longOptions[] = {
+    {"scenario", required_argument, 0, 'S'},
+    {"queues", required_argument, 0, 'q'},
+    {"threads", required_argument, 0, 't'},
+    {"producers", required_argument, 0, 'p'},
+    {"consumers", required_argument, 0, 'c'},
+    {"ratios", required_argument, 0, 'R'},
+    {"mix", required_argument, 0, 'm'},
+    {"size", required_argument, 0, 's'},
+    {"ops", required_argument, 0, 'n'},
+    {"duration", required_argument, 0, 'd'},
+    {"reps", required_argument, 0, 'r'},
+    {"warmup", required_argument, 0, 'w'},
+    {"work", required_argument, 0, 'k'},
+    {"work-dist", required_argument, 0, 'D'},
+    {"capacity", required_argument, 0, 'C'},
+    {"placement", required_argument, 0, 'P'},
+    {"cpus", required_argument, 0, 'L'},
+    {"perf", no_argument, 0, 'E'},
+    {"json", required_argument, 0, 'J'},
+    {"csv", required_argument, 0, 'V'},
+    {"iterations", required_argument, 0, 'i'},
+    {"bias", required_argument, 0, 'b'},
+    {"batch", required_argument, 0, 'B'},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+  opt->Scenario = "suite";
+  split_names("locking,combining,lockless,ebr,segments,bounded", &opt->Queues);
+  opt->Threads.assign(1, 8);
+  opt->Producers.assign(1, 1);
+  opt->Consumers.assign(1, 1);
+  opt->EnqueuePercent = 50;
+  opt->ElementSize = 16;
+  opt->Ops = 1000000;
+  opt->Duration = 0;
+  opt->Reps = 5;
+  opt->Warmup = 1;
+  opt->Work = WorkProfile(100, WorkFixed);
+  opt->Capacity = 1 << 20;
+  opt->Placement = "none";
+  opt->Perf = false;
+  opt->PerfStatus = "off";
+  opt->Iterations = 1000000;
+  opt->Bias = 2;
+  opt->Batch = 1;
+
+  *status = 1;
+  int c;
+  bool ok = true;
+  while(ok && (c = getopt_long(argc, argv, "q:t:p:c:m:s:n:d:r:w:h", longOptions, 0)) != -1){
+    switch(c){
+    case 'S': opt->Scenario = optarg; break;
+    case 'q':
+      if(strcmp(optarg, "all") == 0){
+        opt->Queues.clear();
+        for(int i=0;queue_names[i];i++)
+          opt->Queues.push_back(queue_names[i]);
+      }else{
+        split_names(optarg, &opt->Queues);
+      }
+      break;
+    case 't': ok = parse_counts(optarg, &opt->Threads); break;
+    case 'p': ok = parse_counts(optarg, &opt->Producers); break;
+    case 'c': ok = parse_counts(optarg, &opt->Consumers); break;
+    case 'R': ok = parse_ratios(optarg, &opt->Ratios); break;
+    case 'm': opt->EnqueuePercent = atoi(optarg); ok = opt->EnqueuePercent >= 0 && opt->EnqueuePercent <= 100; break;
+    case 's': opt->ElementSize = atoi(optarg); break;
+    case 'n': opt->Ops = atol(optarg); ok = opt->Ops > 0; break;
+    case 'd': opt->Duration = atof(optarg); ok = opt->Duration > 0; break;
+    case 'r': opt->Reps = atoi(optarg); ok = opt->Reps > 0; break;
+    case 'w': opt->Warmup = atoi(optarg); ok = opt->Warmup >= 0; break;
+    case 'k': opt->Work.MeanNanos = atof(optarg); ok = opt->Work.MeanNanos >= 0; break;
+    case 'D':
+      if(strcmp(optarg, "fixed") == 0) opt->Work.Distribution = WorkFixed;
+      else if(strcmp(optarg, "exponential") == 0 || strcmp(optarg, "exp") == 0) opt->Work.Distribution = WorkExponential;
+      else if(strcmp(optarg, "uniform") == 0) opt->Work.Distribution = WorkUniform;
+      else ok = false;
+      break;
+    case 'C': opt->Capacity = atol(optarg); ok = opt->Capacity > 0; break;
+    case 'P': opt->Placement = optarg; break;
+    case 'L': opt->Placement = "list"; ok = ParseCpuList(optarg, &opt->PlacementCpus); break;
+    case 'E': opt->Perf = true; break;
+    case 'J': opt->JsonPath = optarg; break;
+    case 'V': opt->CsvPath = optarg; break;
+    case 'i': opt->Iterations = atoi(optarg); ok = opt->Iterations > 0; break;
+    case 'b': opt->Bias = atoi(optarg); ok = opt->Bias > 0; break;
+    case 'B': opt->Batch = atoi(optarg); ok = opt->Batch > 0; break;
+    case 'h': usage(argv[0]); *status = 0; return false;
+    default: return false;
+    }
+  }
+  if(!ok){
+    fprintf(stderr, "%s: bad value in %s\n", argv[0], argv[optind-1]);
+    return false;
+  }
+  if(optind < argc){
+    fprintf(stderr, "%s: unexpected argument %s\n", argv[0], argv[optind]);
+    return false;
+  }
+  if(opt->Scenario != "suite" && opt->Scenario != "mixed" && opt->Scenario != "pc" && opt->Scenario != "stall"){
+    fprintf(stderr, "%s: unknown scenario %s\n", argv[0], opt->Scenario.c_str());
+    return false;
+  }
+  // The fixed sections start their own threads unpinned
+  if(opt->Placement != "none" && (opt->Scenario == "suite" || opt->Scenario == "stall")){
+    fprintf(stderr, "%s: --placement and --cpus only apply to the mixed and pc scenarios\n", argv[0]);
+    return false;
+  }
+  CpuTopology topology;
+  if(opt->Placement == "list"){
+    for(size_t i=0;i<opt->PlacementCpus.size();i++){
+      bool allowed = false;
+      for(size_t j=0;j<topology.Cpus().size();j++)
+        allowed = allowed || topology.Cpus()[j].Id == opt->PlacementCpus[i];
+      if(!allowed){
+        fprintf(stderr, "%s: cpu %d is not available\n", argv[0], opt->PlacementCpus[i]);
+        return false;
+      }
+    }
+  }else if(opt->Placement != "none" && !topology.Order(opt->Placement, &opt->PlacementCpus)){
+    fprintf(stderr, "%s: unknown placement %s\n", argv[0], opt->Placement.c_str());
+    return false;
+  }
+  for(size_t i=0;i<opt->Queues.size();i++){
+    Subject<Item<16> >* s = make_subject<Item<16> >(opt->Queues[i], 2, 1);
+    if(!s){
+      fprintf(stderr, "%s: unknown queue %s\n", argv[0], opt->Queues[i].c_str());
+      return false;
+    }
+    delete s;
+  }
+  return true;
+}
+
+// The fixed sequence of every section above
+void run_suite(const Options& opt){
+  int threads = opt.Threads.back();
+  printf("\nIterations %d\n", opt.Iterations);
+  printf("Work %s %g ns\n", work_name(opt.Work.Distribution), opt.Work.MeanNanos);
   printf("Threads %d\n", threads);
-  printf("Series Bias %d\n", bias);
+  printf("Series Bias %d\n", opt.Bias);
+  printf("Series Batch %d\n", opt.Batch);
 
-  random_tests(iterations, sieveBound, threads);
-  series_tests(iterations, sieveBound, threads, bias);
+  random_tests(opt.Iterations, opt.Work, threads);
+  series_tests(opt.Iterations, opt.Work, threads, opt.Bias, opt.Batch);
+  scan_tests(opt.Iterations);
+  stall_tests(opt.Iterations, threads);
+  spsc_tests(opt.Iterations);
+  mpsc_tests(opt.Iterations, threads);
+  fork_join_tests(threads);
+  lock_tests(opt.Iterations, opt.Work, threads, opt.Bias, opt.Batch);
+  latency_tests(opt.Iterations, opt.Work, threads);
+  wakeup_tests(1000);
    
   printf("\n");
+}
+
+int main( int argc, char* argv[] )
+{
+  Options opt;
+  int status;
+  if(!parse_options(argc, argv, &opt, &status)){
+    if(status) fprintf(stderr, "Try %s --help\n", argv[0]);
+    return status;
+  }
+  SpinWork::Calibrate();
+  if(opt.Perf){
+    // Find out once what this machine offers
+    PerfCounters probe;
+    if(!probe.AnyAvailable()){
+      fprintf(stderr, "Hardware counters unavailable (%s), running without them\n", strerror(probe.Error()));
+      opt.Perf = false;
+      opt.PerfStatus = std::string("unavailable: ") + strerror(probe.Error());
+    }else{
+      opt.PerfStatus = "on";
+      for(int i=0;i<PerfCounters::Count;i++)
+        if(!probe.Available(i)) opt.PerfStatus += std::string(", no ") + PerfCounters::Name(i);
+    }
+  }
+  if(opt.Scenario == "suite"){
+    run_suite(opt);
+    return 0;
+  }
+  if(opt.Scenario == "stall"){
+    stall_tests(opt.Iterations, opt.Threads.back());
+    return 0;
+  }
+
+  Metadata meta = collect_metadata(opt);
+  printf("\n");
+  for(size_t i=0;i<meta.size();i++)
+    printf("%-16s %s\n", meta[i].first.c_str(), meta[i].second.c_str());
+  printf("\n");
+
+  std::vector<Result> results;
+  switch(opt.ElementSize){
+  case 16: run_scenarios<Item<16> >(opt, &results); break;
+  case 64: run_scenarios<Item<64> >(opt, &results); break;
+  case 256: run_scenarios<Item<256> >(opt, &results); break;
+  case 1024: run_scenarios<Item<1024> >(opt, &results); break;
+  default:
+    fprintf(stderr, "%s: element size must be 16, 64, 256 or 1024\n", argv[0]);
+    return 1;
+  }
+
+  if(!opt.JsonPath.empty() && !write_json(opt.JsonPath.c_str(), meta, results)){
+    perror(opt.JsonPath.c_str());
+    return 1;
+  }
+  if(!opt.CsvPath.empty() && !write_csv(opt.CsvPath.c_str(), meta, results)){
+    perror(opt.CsvPath.c_str());
+    return 1;
+  }
+  for(size_t i=0;i<results.size();i++)
+    if(!results[i].Pass) return 2;
   return 0;
 }
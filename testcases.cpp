@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <tr1/functional>
 
 #include <sys/time.h>
@@ -10,14 +11,46 @@
 #include <sstream>
 #include <string>
 #include <cstring>
+#include <vector>
+#include <utility>
 
 #include "IQueue.h"
 #include "LockingQueue.h"
 #include "LocklessQueue.h"
+#include "BoundedQueue.h"
+#include "SegmentedQueue.h"
+#include "SPSCQueue.h"
+#include "MPSCQueue.h"
+#include "ShardedQueue.h"
+#include "WorkStealingDeque.h"
+#include "TaskExecutor.h"
+#include "FlatCombiningQueue.h"
 
 using ConcurrentQueues::IQueue;
 using ConcurrentQueues::LockingQueue;
 using ConcurrentQueues::LocklessQueue;
+using ConcurrentQueues::BoundedQueue;
+using ConcurrentQueues::SegmentedQueue;
+using ConcurrentQueues::SPSCQueue;
+using ConcurrentQueues::MPSCQueue;
+using ConcurrentQueues::MPSCHook;
+using ConcurrentQueues::ShardedQueue;
+using ConcurrentQueues::ShardTwoChoice;
+using ConcurrentQueues::ShardRoundRobin;
+using ConcurrentQueues::WorkStealingDeque;
+using ConcurrentQueues::Task;
+using ConcurrentQueues::TaskGroup;
+using ConcurrentQueues::TaskExecutor;
+using ConcurrentQueues::FlatCombiningQueue;
+using ConcurrentQueues::PthreadMutex;
+using ConcurrentQueues::TTASLock;
+using ConcurrentQueues::TicketLock;
+using ConcurrentQueues::MCSLock;
+using ConcurrentQueues::AdaptiveLock;
+using ConcurrentQueues::Node;
+using ConcurrentQueues::EpochReclamation;
+using ConcurrentQueues::QueueStatsSnapshot;
+using ConcurrentQueues::MemoryStats;
 using namespace std;
 
 int numThreads = 10;  //number of threads to use during concurrent tests
@@ -183,6 +216,103 @@ void Case5(IQueue<int>* q) { //mayhem (random add and deletes interlaced). param
   }
 }
 
+void Case6(IQueue<int>* q) { //bulk correctness check (not timed). param: fresh queue
+  int in[10] = {1,2,3,4,5,6,7,8,9,10};
+  int out[20];
+  bool allcorrect = true;
+  q->EnqueueBulk(in, 10);
+  if (q->DequeueBulk(out, 4) != 4) {
+    allcorrect = false;
+  }
+  for (int i = 0; i < 4; i++) {
+    if (out[i] != i + 1) {
+      allcorrect = false;
+    }
+  }
+  q->Enqueue(11);
+  if (q->DequeueBulk(out, 20) != 7) {
+    allcorrect = false;
+  }
+  for (int i = 0; i < 7; i++) {
+    if (out[i] != i + 5) {
+      allcorrect = false;
+    }
+  }
+  if (q->DequeueBulk(out, 20) != 0) {
+    allcorrect = false;
+  }
+  
+  if (allcorrect) {
+    cout << "All values bulk dequeued were correct as expected." << endl;
+  } else {
+    cout << "Incorrect Bulk Dequeued Values." << endl;
+  }
+  
+  delete q;
+}
+
+void Case7(IQueue<int>* q, long* sum) { //bulk adds of 0..499 followed by bulk dequeues, adding up what it got. param: starts with fresh queue
+  int values[50];
+  for (int i = 0; i < 10; i++) {
+    for (int j = 0; j < 50; j++) {
+      values[j] = i * 50 + j;
+    }
+    q->EnqueueBulk(values, 50);
+  }
+  int left = 500;
+  while (left > 0) {
+    size_t n = q->DequeueBulk(values, left < 50 ? left : 50);
+    for (size_t j = 0; j < n; j++) {
+      *sum += values[j];
+    }
+    left -= n;
+  }
+}
+
+// No default constructor, counts live instances so
+// queues can be checked for values they never destroy.
+int liveMessages = 0;
+struct Message {
+  string Text;
+  vector<int> Data;
+  Message(const string& text, int n) : Text(text), Data(n, n) { liveMessages++; }
+  Message(const Message& other) : Text(other.Text), Data(other.Data) { liveMessages++; }
+  Message(Message&& other) : Text(std::move(other.Text)), Data(std::move(other.Data)) { liveMessages++; }
+  Message& operator=(const Message& other) = default;
+  Message& operator=(Message&& other) = default;
+  ~Message() { liveMessages--; }
+};
+
+template<class Q>
+void Case8(Q* q) { //emplace, move and copy in, move out, destroy leftovers. param: fresh queue
+  bool allcorrect = true;
+  {
+    q->Emplace("a", 1);
+    Message b("b", 2);
+    q->Enqueue(std::move(b));
+    const Message c("c", 3);
+    q->Enqueue(c);
+    q->Emplace("d", 4);
+    Message out("", 0);
+    if (!q->Dequeue(&out) || out.Text != "a" || out.Data.size() != 1) {
+      allcorrect = false;
+    }
+    if (!q->Dequeue(&out) || out.Text != "b" || out.Data.size() != 2) {
+      allcorrect = false;
+    }
+    delete q; //c and d are still queued
+  }
+  if (liveMessages != 0) {
+    allcorrect = false;
+  }
+  
+  if (allcorrect) {
+    cout << "All messages were moved and destroyed as expected." << endl;
+  } else {
+    cout << "Incorrect message handling." << endl;
+  }
+}
+
 /*************** Sequential Test Cases ***************/
 
 /*****Locking Queues********/
@@ -235,8 +365,281 @@ void STest9() {
 
 void STest10() {
   LocklessQueue<int>* q = new LocklessQueue<int>();
-  Case5(q->CreateAccessor());
+  IQueue<int>* a = q->CreateAccessor();
+  Case5(a);
+  delete a;
+  unsigned long hits, misses;
+  q->GetPoolStats(&hits, &misses);
+  cout << "Node pool hits " << hits << ", misses " << misses << endl;
+  delete q;
+}
+
+/******Bounded Queues**********/
+void STest11() {
+  Case1(new BoundedQueue<int>(8));
+}
+
+void STest12() {
+  BoundedQueue<int>* q = new BoundedQueue<int>(500);
+  Case4(q);
+  delete q;
+}
+
+/******Epoch Reclaimed Lockless Queues**********/
+typedef LocklessQueue<int, EpochReclamation<Node<int> > > EpochQueue;
+
+void STest13() {
+  EpochQueue* q = new EpochQueue();
+  Case1(q->CreateAccessor());
+  delete q;
+}
+
+void STest14() {
+  EpochQueue* q = new EpochQueue();
+  IQueue<int>* a = q->CreateAccessor();
+  q->BeginBatch(a);
+  Case5(a);
+  q->EndBatch(a);
+  delete a;
+  delete q;
+}
+
+/******Bulk Operations**********/
+void STest15() {
+  Case6(new LockingQueue<int>);
+  LocklessQueue<int>* q = new LocklessQueue<int>();
+  Case6(q->CreateAccessor());
   delete q;
+  Case6(new BoundedQueue<int>(16));
+}
+
+/******Blocking Dequeue**********/
+void STest16() {
+  LockingQueue<int> locking;
+  LocklessQueue<int> lockless;
+  int k;
+  bool allcorrect = !locking.Dequeue(&k, 2000) && !lockless.Dequeue(&k, 2000);
+  locking.Enqueue(5);
+  lockless.Enqueue(6);
+  allcorrect = allcorrect && locking.Dequeue(&k, 2000) && k == 5;
+  allcorrect = allcorrect && lockless.Dequeue(&k, 2000) && k == 6;
+  if (allcorrect) {
+    cout << "Timed dequeues behaved as expected." << endl;
+  } else {
+    cout << "Incorrect timed dequeue." << endl;
+  }
+}
+
+/******Non default constructible values**********/
+void STest17() {
+  Case8(new LockingQueue<Message>());
+  Case8(new LocklessQueue<Message>());
+  Case8(new BoundedQueue<Message>(8));
+}
+
+/******Segmented Queues**********/
+//small segments so the tests cross plenty of segment boundaries
+typedef SegmentedQueue<int, 4> SmallSegmentQueue;
+
+void STest18() {
+  SmallSegmentQueue* q = new SmallSegmentQueue();
+  Case1(q->CreateAccessor());
+  delete q;
+  Case8(new SegmentedQueue<Message, 4>());
+}
+
+/******Single Producer Single Consumer Queues**********/
+void STest19() {
+  Case1(new SPSCQueue<int>(8));
+  Case8(new SPSCQueue<Message>(8));
+}
+
+/******Intrusive Many Producer Single Consumer Queues**********/
+struct Letter : MPSCHook {
+  int Sender;
+  int Seq;
+};
+
+void STest20() {
+  MPSCQueue<Letter> q;
+  Letter letters[5];
+  Letter* l;
+  bool allcorrect = !q.Dequeue(&l);
+  for (int i = 0; i < 3; i++) {
+    letters[i].Seq = i;
+    q.Enqueue(&letters[i]);
+  }
+  allcorrect = allcorrect && q.Dequeue(&l) && l == &letters[0];
+  allcorrect = allcorrect && q.Dequeue(&l) && l == &letters[1];
+  allcorrect = allcorrect && q.Dequeue(&l) && l == &letters[2];
+  allcorrect = allcorrect && !q.Dequeue(&l);
+  //reuse a letter once it has been dequeued
+  q.Enqueue(&letters[0]);
+  q.Enqueue(&letters[3]);
+  allcorrect = allcorrect && q.Dequeue(&l) && l == &letters[0];
+  allcorrect = allcorrect && q.Dequeue(&l) && l == &letters[3];
+  allcorrect = allcorrect && !q.Dequeue(&l);
+  if (allcorrect) {
+    cout << "All letters dequeued were correct as expected." << endl;
+  } else {
+    cout << "Incorrect letters dequeued." << endl;
+  }
+}
+
+/******Sharded Queues**********/
+typedef ShardedQueue<int, LocklessQueue<int> > ShardedLockless;
+typedef ShardedQueue<int, BoundedQueue<int> > ShardedBounded;
+
+void STest21() {
+  Case1(new ShardedLockless(4, ShardTwoChoice));
+  Case1(new ShardedBounded(4, ShardRoundRobin, 16));
+  
+  //a full home shard spills into the others instead of blocking
+  ShardedBounded* q = new ShardedBounded(4, ShardRoundRobin, 2);
+  for (int i = 1; i <= 8; i++) {
+    q->Enqueue(i);
+  }
+  int k, sum = 0, n = 0;
+  while (q->Dequeue(&k)) {
+    sum += k;
+    n++;
+  }
+  if (n == 8 && sum == 36) {
+    cout << "Full home shard spilled into the others." << endl;
+  } else {
+    cout << "Incorrect spill, " << n << " values dequeued." << endl;
+  }
+  delete q;
+}
+
+/******Work Stealing Deques**********/
+void STest22() {
+  WorkStealingDeque<long> d(4);
+  long k;
+  bool allcorrect = !d.Pop(&k) && !d.Steal(&k);
+  for (long i = 1; i <= 10; i++) { //grows twice
+    d.Push(i);
+  }
+  allcorrect = allcorrect && d.Pop(&k) && k == 10; //owner takes the newest
+  allcorrect = allcorrect && d.Steal(&k) && k == 1; //thieves take the oldest
+  allcorrect = allcorrect && d.Steal(&k) && k == 2;
+  for (long i = 9; i >= 3; i--) {
+    allcorrect = allcorrect && d.Pop(&k) && k == i;
+  }
+  allcorrect = allcorrect && !d.Pop(&k) && !d.Steal(&k);
+  if (allcorrect) {
+    cout << "All values popped and stolen were correct as expected." << endl;
+  } else {
+    cout << "Incorrect pop or steal." << endl;
+  }
+}
+
+/******Flat Combining Queues**********/
+void STest23() {
+  Case1(new FlatCombiningQueue<int>());
+  Case6(new FlatCombiningQueue<int>());
+  Case8(new FlatCombiningQueue<Message>());
+}
+
+/******Locking Queues with each lock policy**********/
+void STest24() {
+  Case1(new LockingQueue<int, PthreadMutex>());
+  Case1(new LockingQueue<int, TTASLock>());
+  Case1(new LockingQueue<int, TicketLock>());
+  Case1(new LockingQueue<int, MCSLock>());
+  Case1(new LockingQueue<int, AdaptiveLock>());
+  Case6(new LockingQueue<int, MCSLock>());
+}
+
+/******Lockless Queue memory accounting**********/
+//one accessor stalls after a dequeue, holding its hazard pointers or its epoch
+//pin, while another runs enqueue/dequeue pairs against an unreclaimed limit.
+//a third retires nodes during the stall and goes away, the others have to
+//take them over
+template<class Q>
+void MemoryBound(const char* name, bool pinned) {
+  Q* q = new Q();
+  q->SetUnreclaimedLimit(100);
+  IQueue<int>* stalled = q->CreateAccessor();
+  IQueue<int>* a = q->CreateAccessor();
+  int k;
+  a->Enqueue(0);
+  if (pinned) q->BeginBatch(stalled);
+  stalled->Dequeue(&k);
+  for (int i = 0; i < 1000; i++) {
+    a->Enqueue(i);
+  }
+  for (int i = 0; i < 5000; i++) {
+    a->Enqueue(i);
+    a->Dequeue(&k);
+  }
+  MemoryStats stalledStats;
+  q->GetMemoryStats(&stalledStats);
+  IQueue<int>* gone = q->CreateAccessor();
+  for (int i = 0; i < 150; i++) {
+    gone->Enqueue(i);
+    gone->Dequeue(&k);
+  }
+  delete gone;
+  if (pinned) q->EndBatch(stalled);
+  for (int i = 0; i < 1000; i++) {
+    a->Enqueue(i);
+    a->Dequeue(&k);
+  }
+  MemoryStats stats;
+  q->GetMemoryStats(&stats);
+  
+  if (stalledStats.LiveNodes != 1001 || stats.LiveNodes != 1001 || stats.Records != 3 ||
+      stats.LiveNodes + stats.RetiredNodes > stats.AllocatedNodes ||
+      stats.NodeBytes != stats.AllocatedNodes * sizeof(Node<int>) || stats.RecordBytes == 0) {
+    cout << name << ": incorrect memory accounting." << endl;
+  } else if (stats.RetiredNodes > 100) {
+    cout << name << ": unreclaimed limit not enforced, " << stats.RetiredNodes << " retired." << endl;
+  } else if (pinned && (stalledStats.Throttles == 0 || stalledStats.Throttles > 4)) {
+    // A stuck pin should stop the throttling after a pass or two
+    cout << name << ": throttling incorrect, " << stalledStats.Throttles << " throttled enqueues." << endl;
+  } else {
+    cout << name << ": " << stalledStats.RetiredNodes << " retired while stalled, " << stats.RetiredNodes
+         << " after, " << stats.AllocatedNodes << " allocated, " << stats.Throttles << " throttled enqueues." << endl;
+  }
+  delete stalled;
+  delete a;
+  delete q;
+}
+
+void STest25() {
+  MemoryBound<LocklessQueue<int> >("Hazard pointers", false);
+  MemoryBound<EpochQueue>("Epochs", true);
+}
+
+/******Thread Local Records**********/
+void STest26() {
+  //more queues in direct use than there are pthread keys,
+  //the last ones borrow a record for each call
+  const int numQueues = 1500;
+  std::vector<EpochQueue*> queues;
+  bool allcorrect = true;
+  for (int i = 0; i < numQueues; i++) {
+    queues.push_back(new EpochQueue());
+    queues[i]->BeginBatch();
+    queues[i]->Enqueue(i);
+    queues[i]->Enqueue(i + 1);
+    queues[i]->EndBatch();
+  }
+  for (int i = 0; i < numQueues; i++) {
+    int a = -1, b = -1, c;
+    if (!queues[i]->Dequeue(&a) || !queues[i]->Dequeue(&b) || queues[i]->Dequeue(&c) ||
+        a != i || b != i + 1) {
+      allcorrect = false;
+    }
+    delete queues[i];
+  }
+  
+  if (allcorrect) {
+    cout << "All values dequeued were correct as expected." << endl;
+  } else {
+    cout << "Incorrect values without a thread local record." << endl;
+  }
 }
 
 /*************** Concurrent Test Cases **************/
@@ -352,6 +755,591 @@ void CTest8() {
 }
 
 
+/****** Bounded Queues *******/
+void CTest9() {
+  pthread_t allthreads[numThreads];
+  BoundedQueue<int> *q = new BoundedQueue<int>(500 * numThreads);
+  for (int i = 0; i < numThreads; i++) {
+    allthreads[i] = makeThread(std::tr1::bind(&Case4, q));
+  }
+  
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+  }
+  
+  delete q;
+}
+
+/****** Epoch Reclaimed Lockless Queues *******/
+void CTest10() {
+  pthread_t allthreads[numThreads];
+  IQueue<int>* accessors[numThreads];
+  EpochQueue *q = new EpochQueue();
+  for (int i = 0; i < numThreads; i++) {
+    accessors[i] = q->CreateAccessor();
+    allthreads[i] = makeThread(std::tr1::bind(&Case5, accessors[i]));
+  }
+  
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+    delete accessors[i];
+  }
+  
+  delete q;
+}
+
+/****** Segmented Queues *******/
+void CTest14() {
+  pthread_t allthreads[numThreads];
+  IQueue<int>* accessors[numThreads];
+  SmallSegmentQueue *q = new SmallSegmentQueue();
+  for (int i = 0; i < numThreads; i++) {
+    accessors[i] = q->CreateAccessor();
+    allthreads[i] = makeThread(std::tr1::bind(&Case5, accessors[i]));
+  }
+  
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+    delete accessors[i];
+  }
+  
+  unsigned long hits, misses;
+  q->GetPoolStats(&hits, &misses);
+  cout << "Segment pool hits " << hits << ", misses " << misses << endl;
+  delete q;
+}
+
+/****** Single Producer Single Consumer Queues *******/
+//one producer, one consumer, values must arrive in order
+void SPSCConsumer(SPSCQueue<int>* q, bool* inorder) {
+  int k;
+  for (int i = 0; i < 100000; i++) {
+    while (!q->Dequeue(&k)) {
+      sched_yield();
+    }
+    if (k != i) {
+      *inorder = false;
+    }
+  }
+}
+
+void CTest15() {
+  SPSCQueue<int> *q = new SPSCQueue<int>(64);
+  bool inorder = true;
+  pthread_t consumer = makeThread(std::tr1::bind(&SPSCConsumer, q, &inorder));
+  for (int i = 0; i < 100000; i++) {
+    q->Enqueue(i);
+  }
+  pthread_join(consumer, NULL);
+  
+  if (inorder) {
+    cout << "All values arrived in order." << endl;
+  } else {
+    cout << "Values arrived out of order." << endl;
+  }
+  delete q;
+}
+
+/****** Intrusive Many Producer Single Consumer Queues *******/
+//each sender posts 500 letters, which must arrive in the order sent
+void LetterSender(MPSCQueue<Letter>* q, Letter* letters, int sender) {
+  for (int i = 0; i < 500; i++) {
+    letters[i].Sender = sender;
+    letters[i].Seq = i;
+    q->Enqueue(&letters[i]);
+  }
+}
+
+void CTest16() {
+  pthread_t allthreads[numThreads];
+  MPSCQueue<Letter> *q = new MPSCQueue<Letter>();
+  Letter* letters = new Letter[500 * numThreads];
+  for (int i = 0; i < numThreads; i++) {
+    allthreads[i] = makeThread(std::tr1::bind(&LetterSender, q, letters + 500 * i, i));
+  }
+  
+  vector<int> next(numThreads, 0);
+  bool inorder = true;
+  Letter* l;
+  for (int i = 0; i < 500 * numThreads; i++) {
+    while (!q->Dequeue(&l)) {
+      sched_yield();
+    }
+    if (l->Seq != next[l->Sender]++) {
+      inorder = false;
+    }
+  }
+  
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+  }
+  
+  if (inorder && !q->Dequeue(&l)) {
+    cout << "All letters arrived in order." << endl;
+  } else {
+    cout << "Letters arrived out of order." << endl;
+  }
+  delete[] letters;
+  delete q;
+}
+
+/****** Sharded Queues *******/
+//interleaved adds and deletes, counting the deletes that found a value
+void ShardedWorker(ShardedLockless* q, int* taken) {
+  int k;
+  for (int i = 0; i < 20000; i++) {
+    q->Enqueue(i);
+    q->Enqueue(i);
+    if (q->Dequeue(&k)) {
+      (*taken)++;
+    }
+  }
+}
+
+void CTest17() {
+  pthread_t allthreads[numThreads];
+  int taken[numThreads];
+  ShardedLockless *q = new ShardedLockless(numThreads / 2, ShardTwoChoice);
+  for (int i = 0; i < numThreads; i++) {
+    taken[i] = 0;
+    allthreads[i] = makeThread(std::tr1::bind(&ShardedWorker, q, &taken[i]));
+  }
+  
+  int total = 0;
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+    total += taken[i];
+  }
+  
+  //every shard has to be drained through stealing
+  int k;
+  while (q->Dequeue(&k)) {
+    total++;
+  }
+  if (total == numThreads * 40000) {
+    cout << "Every value was dequeued once." << endl;
+  } else {
+    cout << "Values were lost or duplicated." << endl;
+  }
+  delete q;
+}
+
+/****** Work Stealing Deques *******/
+//thieves steal until the owner is done, marking what they took
+void Thief(WorkStealingDeque<long>* d, char* seen, bool* ownerDone) {
+  long k;
+  while (!__atomic_load_n(ownerDone, __ATOMIC_ACQUIRE) || !d->Empty()) {
+    if (d->Steal(&k)) {
+      seen[k]++;
+    }
+  }
+}
+
+void CTest18() {
+  const long total = 200000;
+  pthread_t thieves[numThreads];
+  WorkStealingDeque<long> *d = new WorkStealingDeque<long>(16);
+  char* seen = new char[total];
+  memset(seen, 0, total);
+  bool ownerDone = false;
+  for (int i = 0; i < numThreads; i++) {
+    thieves[i] = makeThread(std::tr1::bind(&Thief, d, seen, &ownerDone));
+  }
+  //owner pushes everything, popping every third value back
+  long k;
+  for (long i = 0; i < total; i++) {
+    d->Push(i);
+    if (i % 3 == 0 && d->Pop(&k)) {
+      seen[k]++;
+    }
+  }
+  while (d->Pop(&k)) {
+    seen[k]++;
+  }
+  __atomic_store_n(&ownerDone, true, __ATOMIC_RELEASE);
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(thieves[i], NULL);
+  }
+  
+  bool once = true;
+  for (long i = 0; i < total; i++) {
+    if (seen[i] != 1) {
+      once = false;
+    }
+  }
+  if (once) {
+    cout << "Every value was taken exactly once." << endl;
+  } else {
+    cout << "Values were lost or taken twice." << endl;
+  }
+  delete[] seen;
+  delete d;
+}
+
+/****** Task Executor *******/
+struct SumTask : Task {
+  TaskExecutor* Executor;
+  long From;
+  long To;
+  long Result;
+  SumTask(TaskExecutor* executor, long from, long to) : Executor(executor), From(from), To(to), Result(0) {}
+  //splits the range in two until it is small, sums the halves
+  void Run() {
+    if (To - From <= 100) {
+      for (long i = From; i < To; i++) {
+        Result += i;
+      }
+      return;
+    }
+    long mid = (From + To) / 2;
+    SumTask left(Executor, From, mid);
+    SumTask right(Executor, mid, To);
+    TaskGroup group;
+    Executor->Submit(&left, &group);
+    Executor->Submit(&right, &group);
+    Executor->Wait(&group);
+    Result = left.Result + right.Result;
+  }
+};
+
+void CTest19() {
+  bool allcorrect = true;
+  for (int stealing = 0; stealing < 2; stealing++) {
+    TaskExecutor executor(numThreads, stealing == 1);
+    SumTask root(&executor, 0, 1000000);
+    TaskGroup group;
+    executor.Submit(&root, &group);
+    executor.Wait(&group);
+    if (root.Result != 1000000L * 999999L / 2) {
+      allcorrect = false;
+    }
+  }
+  if (allcorrect) {
+    cout << "Fork-join sums were correct with and without stealing." << endl;
+  } else {
+    cout << "Incorrect fork-join sum." << endl;
+  }
+}
+
+/****** Flat Combining Queues *******/
+//enqueues 1..20000 with a dequeue after most of them, so both kinds of
+//operation keep getting combined, and adds up what it got
+void CombiningWorker(IQueue<int>* q, long* sum) {
+  int k;
+  for (int i = 1; i <= 20000; i++) {
+    q->Enqueue(i);
+    if (i % 4 != 0 && q->Dequeue(&k)) {
+      *sum += k;
+    }
+  }
+}
+
+void CTest20() {
+  pthread_t allthreads[numThreads];
+  long sums[numThreads];
+  FlatCombiningQueue<int> *q = new FlatCombiningQueue<int>();
+  for (int i = 0; i < numThreads; i++) {
+    sums[i] = 0;
+    allthreads[i] = makeThread(std::tr1::bind(&CombiningWorker, q, &sums[i]));
+  }
+  
+  long sum = 0;
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+    sum += sums[i];
+  }
+  int k;
+  while (q->Dequeue(&k)) {
+    sum += k;
+  }
+  
+  if (sum == (long)numThreads * 20000 * 20001 / 2) {
+    cout << "Every value dequeued once." << endl;
+  } else {
+    cout << "Incorrect sum, values lost or duplicated." << endl;
+  }
+  delete q;
+}
+
+/****** Locking Queues with each lock policy *******/
+//enqueues 1..5000, dequeuing after every other enqueue, and adds up what it got
+void LockPolicyWorker(IQueue<int>* q, long* sum) {
+  int k;
+  for (int i = 1; i <= 5000; i++) {
+    q->Enqueue(i);
+    if (i % 2 == 0 && q->Dequeue(&k)) {
+      *sum += k;
+    }
+  }
+}
+
+template<class Lock>
+void LockPolicyMayhem(const char* name) {
+  pthread_t allthreads[numThreads];
+  long sums[numThreads];
+  LockingQueue<int, Lock> *q = new LockingQueue<int, Lock>();
+  for (int i = 0; i < numThreads; i++) {
+    sums[i] = 0;
+    allthreads[i] = makeThread(std::tr1::bind(&LockPolicyWorker, q, &sums[i]));
+  }
+  
+  long sum = 0;
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+    sum += sums[i];
+  }
+  int k;
+  while (q->Dequeue(&k)) {
+    sum += k;
+  }
+  
+  if (sum == (long)numThreads * 5000 * 5001 / 2) {
+    cout << name << ": every value dequeued once." << endl;
+  } else {
+    cout << name << ": incorrect sum, values lost or duplicated." << endl;
+  }
+  delete q;
+}
+
+void CTest21() {
+  LockPolicyMayhem<PthreadMutex>("Pthread mutex");
+  LockPolicyMayhem<TTASLock>("TTAS");
+  LockPolicyMayhem<TicketLock>("Ticket");
+  LockPolicyMayhem<MCSLock>("MCS");
+  LockPolicyMayhem<AdaptiveLock>("Adaptive");
+}
+
+/****** Lockless Queue statistics *******/
+//interleaved enqueues and dequeues through an accessor per thread, then checks
+//the counters add up; they are only there when built with CONCURRENTQUEUES_STATS
+template<class Q>
+void StatsMayhem(const char* name) {
+  pthread_t allthreads[numThreads];
+  IQueue<int>* accessors[numThreads];
+  Q *q = new Q();
+  for (int i = 0; i < numThreads; i++) {
+    accessors[i] = q->CreateAccessor();
+    allthreads[i] = makeThread(std::tr1::bind(&Case5, accessors[i]));
+  }
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+    delete accessors[i];
+  }
+  
+  QueueStatsSnapshot stats;
+  if (!q->GetStats(&stats)) {
+    cout << name << ": statistics not compiled in, " << stats.Records << " records." << endl;
+  } else if (stats.Records == 0 || stats.Totals.Scans == 0 ||
+             stats.Totals.ScanFreed > (unsigned long)numThreads * 79300 || // Case5 dequeues
+             stats.Totals.EnqueueCasFailures > stats.Totals.EnqueueRetries ||
+             stats.Totals.DequeueCasFailures > stats.Totals.DequeueRetries) {
+    cout << name << ": incorrect statistics." << endl;
+  } else {
+    cout << name << ": " << stats.Records << " records, " << stats.HazardPointers << " hazard pointers, "
+         << stats.Totals.EnqueueCasFailures << "/" << stats.Totals.EnqueueRetries << " enqueue CAS failures/retries, "
+         << stats.Totals.DequeueCasFailures << "/" << stats.Totals.DequeueRetries << " dequeue CAS failures/retries, "
+         << stats.Totals.TailFixups << " tail fixups, " << stats.Totals.Scans << " scans, "
+         << stats.Totals.HelpScans << " helpscans, " << stats.FreedPerScan() << " freed per scan, "
+         << stats.Totals.RetireHighWater << " retire high water, " << stats.Totals.RecordReuses << " reuses." << endl;
+  }
+  delete q;
+}
+
+void CTest22() {
+  StatsMayhem<LocklessQueue<int> >("Hazard pointers");
+  StatsMayhem<EpochQueue>("Epochs");
+}
+
+/****** Lockless Queue memory ordering stress *******/
+//producers enqueue 1..20000, singly and, with bulk, in groups, while
+//consumers dequeue until every value is out; built with -fsanitize=thread
+//this checks the orderings of the lock free queues and their reclaimers,
+//see the README
+void OrderingProducer(IQueue<int>* q, bool bulk) {
+  int values[16];
+  for (int i = 1; i <= 20000; ) {
+    if (bulk && i % 3 == 0 && i + 16 <= 20000) {
+      for (int j = 0; j < 16; j++) values[j] = i + j;
+      q->EnqueueBulk(values, 16);
+      i += 16;
+    } else {
+      q->Enqueue(i++);
+    }
+  }
+}
+
+void OrderingConsumer(IQueue<int>* q, bool bulk, std::atomic<long>* left, long* sum) {
+  int values[16];
+  while (left->load() > 0) {
+    size_t n = bulk ? q->DequeueBulk(values, 1 + (*sum % 16)) : q->Dequeue(&values[0]);
+    for (size_t j = 0; j < n; j++) *sum += values[j];
+    if (n) left->fetch_sub(n);
+    else sched_yield();
+  }
+}
+
+template<class Q>
+void OrderingMayhem(const char* name, Q* q, bool bulk) {
+  int producers = numThreads > 1 ? numThreads / 2 : 1;
+  int consumers = numThreads > 1 ? numThreads - producers : 1;
+  pthread_t allthreads[producers + consumers];
+  IQueue<int>* accessors[producers + consumers];
+  long sums[consumers];
+  std::atomic<long> left((long)producers * 20000);
+  for (int i = 0; i < producers + consumers; i++) {
+    accessors[i] = q->CreateAccessor();
+    if (i < producers) {
+      allthreads[i] = makeThread(std::tr1::bind(&OrderingProducer, accessors[i], bulk));
+    } else {
+      sums[i - producers] = 0;
+      allthreads[i] = makeThread(std::tr1::bind(&OrderingConsumer, accessors[i], bulk, &left, &sums[i - producers]));
+    }
+  }
+  long sum = 0;
+  for (int i = 0; i < producers + consumers; i++) {
+    pthread_join(allthreads[i], NULL);
+    delete accessors[i];
+    if (i >= producers) sum += sums[i - producers];
+  }
+  
+  int k;
+  if (sum == (long)producers * 20000 * 20001 / 2 && !q->Dequeue(&k)) {
+    cout << name << ": every value dequeued once." << endl;
+  } else {
+    cout << name << ": incorrect sum, values lost or duplicated." << endl;
+  }
+  delete q;
+}
+
+//the lockless queues run with reclamation held to a tight limit
+void CTest23() {
+  LocklessQueue<int>* hp = new LocklessQueue<int>();
+  hp->SetUnreclaimedLimit(64);
+  OrderingMayhem("Hazard pointers", hp, true);
+  EpochQueue* epochs = new EpochQueue();
+  epochs->SetUnreclaimedLimit(64);
+  OrderingMayhem("Epochs", epochs, true);
+  OrderingMayhem("Segments", new SegmentedQueue<int, 4>(), false);
+}
+
+/****** Lockless Queues without accessors *******/
+//group of adds followed by group of dequeues through the thread local path
+void Case4Direct(LocklessQueue<int>* q) {
+  int k;
+  for (int i = 0; i < 500; i++) {
+    q->Enqueue(i);
+  }
+  for (int i = 0; i < 500; i++) {
+    q->Dequeue(&k);
+  }
+}
+
+void CTest11() {
+  pthread_t allthreads[numThreads];
+  LocklessQueue<int> *q = new LocklessQueue<int>();
+  for (int i = 0; i < numThreads; i++) {
+    allthreads[i] = makeThread(std::tr1::bind(&Case4Direct, q));
+  }
+  
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+  }
+  
+  int k;
+  if (q->Dequeue(&k)) {
+    cout << "Queue should be empty." << endl;
+  } else {
+    cout << "Queue is empty as expected." << endl;
+  }
+  delete q;
+}
+
+/****** Bulk Operations *******/
+void CTest12() {
+  pthread_t allthreads[numThreads];
+  IQueue<int>* accessors[numThreads];
+  long sums[numThreads];
+  LocklessQueue<int> *q = new LocklessQueue<int>();
+  for (int i = 0; i < numThreads; i++) {
+    sums[i] = 0;
+    accessors[i] = q->CreateAccessor();
+    allthreads[i] = makeThread(std::tr1::bind(&Case7, accessors[i], &sums[i]));
+  }
+  
+  long sum = 0;
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(allthreads[i], NULL);
+    delete accessors[i];
+    sum += sums[i];
+  }
+  int k;
+  if (sum == (long)numThreads * 499 * 500 / 2 && !q->Dequeue(&k)) {
+    cout << "Every value dequeued once." << endl;
+  } else {
+    cout << "Incorrect sum, values lost or duplicated." << endl;
+  }
+  
+  delete q;
+}
+
+/****** Blocking Dequeue *******/
+void BlockingConsumer(LocklessQueue<int>* q, long* sum) {
+  int k;
+  for (int i = 0; i < 500; i++) {
+    q->WaitDequeue(&k);
+    *sum += k;
+  }
+}
+
+void BlockingProducer(LocklessQueue<int>* q) {
+  for (int i = 1; i <= 500; i++) {
+    q->Enqueue(i);
+    if (i % 100 == 0) {
+      usleep(1000);
+    }
+  }
+}
+
+void CTest13() {
+  pthread_t consumers[numThreads];
+  pthread_t producers[numThreads];
+  long sums[numThreads];
+  LocklessQueue<int> *q = new LocklessQueue<int>();
+  for (int i = 0; i < numThreads; i++) {
+    sums[i] = 0;
+    consumers[i] = makeThread(std::tr1::bind(&BlockingConsumer, q, &sums[i]));
+  }
+  for (int i = 0; i < numThreads; i++) {
+    producers[i] = makeThread(std::tr1::bind(&BlockingProducer, q));
+  }
+  
+  long sum = 0;
+  for (int i = 0; i < numThreads; i++) {
+    pthread_join(producers[i], NULL);
+    pthread_join(consumers[i], NULL);
+    sum += sums[i];
+  }
+  if (sum == (long)numThreads * 500 * 501 / 2) {
+    cout << "Every value dequeued once." << endl;
+  } else {
+    cout << "Incorrect sum, values lost or duplicated." << endl;
+  }
+  
+  // Nothing is left, so a timed wait has to run out
+  struct timeval begin, end;
+  int k;
+  gettimeofday(&begin, NULL);
+  bool got = q->Dequeue(&k, 20000);
+  gettimeofday(&end, NULL);
+  long waited = (end.tv_sec - begin.tv_sec) * 1000000L + (end.tv_usec - begin.tv_usec);
+  if (!got && waited >= 15000) { // gettimeofday is not the monotonic clock it waited on
+    cout << "Timed dequeue on the drained queue expired." << endl;
+  } else {
+    cout << "Timed dequeue incorrect, " << (got ? "got a value" : "returned early") << "." << endl;
+  }
+  
+  delete q;
+}
 
 /*************** Main Program Starts Here *************/
 //Runs every test, records times, then prints them all out at the very end.
@@ -360,7 +1348,7 @@ void CTest8() {
 //If parameter is not specified, the program defaults to 10 threads.
 int main( int argc, const char* argv[] ) {
     //check existence of optional argument
-	if (argc == 2) {
+	if (argc >= 2) {
 	  int nthreads = atoi(argv[1]);
 	  if (nthreads > 0) {
 	    numThreads = nthreads;
@@ -371,6 +1359,16 @@ int main( int argc, const char* argv[] ) {
 	struct timeval end; //end timestamps for each individual test
 	struct timeval myresult; //stores the time difference for each test
 
+	//"stress" runs only the ordering stress test, for sanitizer builds
+	if (argc >= 3 && strcmp(argv[2], "stress") == 0) {
+	  cout << "Conc Test 23: Lockless and Segmented Queues, memory ordering stress" << endl;
+	  gettimeofday(&begin, NULL);
+	  CTest23();
+	  gettimeofday(&end, NULL); 
+	  printElapsed(&end, &begin);
+	  exit(0);
+	}
+
     cout << "Sequential Tests:" << endl;
 	
 	cout << "\nSeq Test 1: Locking Queue, basic correctness check" << endl;
@@ -427,6 +1425,60 @@ int main( int argc, const char* argv[] ) {
 	gettimeofday(&end, NULL); 
 	printElapsed(&end, &begin);
 	
+	cout << "\nSeq Test 11: Bounded Queue, basic correctness check" << endl;
+	STest11();
+	
+	cout << "\nSeq Test 12: Bounded Queue, group of adds followed by group of dequeues" << endl;
+	gettimeofday(&begin, NULL);
+	STest12();
+	gettimeofday(&end, NULL);
+	printElapsed(&end, &begin);
+	
+	cout << "\nSeq Test 13: Epoch Reclaimed LockLESS Queue, basic correctness check" << endl;
+	STest13();
+	
+	cout << "\nSeq Test 14: Epoch Reclaimed LockLESS Queue, mayhem in one batch" << endl;
+	gettimeofday(&begin, NULL);
+	STest14();
+	gettimeofday(&end, NULL);
+	printElapsed(&end, &begin);
+	
+	cout << "\nSeq Test 15: Locking, LockLESS and Bounded Queues, bulk correctness check" << endl;
+	STest15();
+	
+	cout << "\nSeq Test 16: Locking and LockLESS Queues, timed dequeue" << endl;
+	STest16();
+	
+	cout << "\nSeq Test 17: Locking, LockLESS and Bounded Queues, non default constructible values" << endl;
+	STest17();
+	
+	cout << "\nSeq Test 18: Segmented Queue, basic correctness check and non default constructible values" << endl;
+	STest18();
+	
+	cout << "\nSeq Test 19: SPSC Queue, basic correctness check and non default constructible values" << endl;
+	STest19();
+	
+	cout << "\nSeq Test 20: Intrusive MPSC Queue, basic correctness check" << endl;
+	STest20();
+	
+	cout << "\nSeq Test 21: Sharded Queues, basic correctness check" << endl;
+	STest21();
+	
+	cout << "\nSeq Test 22: Work Stealing Deque, push, pop and steal order" << endl;
+	STest22();
+	
+	cout << "\nSeq Test 23: Flat Combining Queue, basic, bulk and non default constructible values" << endl;
+	STest23();
+	
+	cout << "\nSeq Test 24: Locking Queue with each lock policy, basic and bulk correctness check" << endl;
+	STest24();
+	
+	cout << "\nSeq Test 25: Lockless Queue, memory accounting with a stalled reader" << endl;
+	STest25();
+	
+	cout << "\nSeq Test 26: Epoch Reclaimed LockLESS Queues, more in direct use than thread local keys" << endl;
+	STest26();
+	
 	cout << "\nConcurrent Tests:" << endl;
 	cout << "\nConc Test 1: Locking Queue, all enqueues" << endl;
 	gettimeofday(&begin, NULL);
@@ -476,5 +1528,95 @@ int main( int argc, const char* argv[] ) {
 	gettimeofday(&end, NULL); 
 	printElapsed(&end, &begin);
 	
+	cout << "\nConc Test 9: Bounded Queue, group of adds followed by group of dequeues" << endl;
+	gettimeofday(&begin, NULL);
+	CTest9();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 10: Epoch Reclaimed LockLESS Queue, mayhem" << endl;
+	gettimeofday(&begin, NULL);
+	CTest10();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 11: LockLESS Queue without accessors, group of adds followed by group of dequeues" << endl;
+	gettimeofday(&begin, NULL);
+	CTest11();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 12: LockLESS Queue, bulk adds followed by bulk dequeues" << endl;
+	gettimeofday(&begin, NULL);
+	CTest12();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 13: LockLESS Queue, consumers blocked in WaitDequeue" << endl;
+	gettimeofday(&begin, NULL);
+	CTest13();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 14: Segmented Queue, mayhem" << endl;
+	gettimeofday(&begin, NULL);
+	CTest14();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 15: SPSC Queue, one producer and one consumer" << endl;
+	gettimeofday(&begin, NULL);
+	CTest15();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 16: Intrusive MPSC Queue, many producers and one consumer" << endl;
+	gettimeofday(&begin, NULL);
+	CTest16();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 17: Sharded LockLESS Queue, interleaved adds and deletes" << endl;
+	gettimeofday(&begin, NULL);
+	CTest17();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 18: Work Stealing Deque, owner against thieves" << endl;
+	gettimeofday(&begin, NULL);
+	CTest18();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 19: Task Executor, fork-join sum" << endl;
+	gettimeofday(&begin, NULL);
+	CTest19();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 20: Flat Combining Queue, mayhem" << endl;
+	gettimeofday(&begin, NULL);
+	CTest20();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 21: Locking Queue with each lock policy, interleaved enqueues and dequeues" << endl;
+	gettimeofday(&begin, NULL);
+	CTest21();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 22: Lockless Queue, contention and reclamation statistics" << endl;
+	gettimeofday(&begin, NULL);
+	CTest22();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
+	cout << "\nConc Test 23: Lockless and Segmented Queues, memory ordering stress" << endl;
+	gettimeofday(&begin, NULL);
+	CTest23();
+	gettimeofday(&end, NULL); 
+	printElapsed(&end, &begin);
+	
     exit(0);
 }